@@ -9,6 +9,7 @@
 #include "./modules/keywords.hpp"
 #include "./modules/definitions.hpp"
 #include "./modules/immutable.hpp"
+#include "./modules/shortcircuit.hpp"
 
 namespace analyzers {
 
@@ -24,7 +25,8 @@ namespace analyzers {
         std::vector <analyzer_data> analyzers = {
                 {keywords::name,    keywords::analyze},
                 {definitions::name, definitions::analyze},
-                {immutable::name,   immutable::analyze}
+                {immutable::name,   immutable::analyze},
+                {shortcircuit::name, shortcircuit::analyze}
         };
 
         for (analyzer_data& i: analyzers) {
@@ -73,6 +73,9 @@ namespace analyzers {
 
             scope_wraps.push_back(-1);
             scopes.resize(1);
+            for (auto& i: ast_nodes::builtins) {
+                scopes.back().push_back(i.identifier);
+            }
 
             tree->visit(at_enter, ast_nodes::dummy, at_exit);
         }
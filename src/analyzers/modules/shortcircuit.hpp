@@ -0,0 +1,79 @@
+#ifndef __ANALYZERS_SHORTCIRCUIT_INCLUDED__
+#define __ANALYZERS_SHORTCIRCUIT_INCLUDED__
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <format>
+
+#include "../../ast_lib.hpp"
+
+namespace analyzers {
+    namespace shortcircuit {
+
+        const std::string name = "shortcircuit";
+
+        // First call or input read found in the scanned term
+        ast_nodes::Node* side_effect = nullptr;
+
+        void find_side_effect(ast_nodes::Node* node) {
+            if (side_effect != nullptr) return;
+
+            ast_nodes::PrimaryNode* primary = dynamic_cast<ast_nodes::PrimaryNode*>(node);
+            ast_nodes::TailNode* tail = dynamic_cast<ast_nodes::TailNode*>(node);
+
+            if ((primary != nullptr && (primary->type == 'i' || primary->type == 'r' || primary->type == 's')) ||
+                (tail != nullptr && tail->type == 'p')) {
+                side_effect = node;
+            }
+        }
+
+        std::ostream* warnings = &std::cerr;
+
+        void at_enter(ast_nodes::Node* node) {
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(node);
+
+            if (expr_node == nullptr || expr_node->ops.empty()) return;
+
+            std::vector<int> rpn;
+            std::vector<int> jumps;
+            arithmetic::expression_order(expr_node->ops, rpn);
+            arithmetic::short_circuit_jumps(rpn, jumps);
+
+            for (size_t i = 0; i < rpn.size(); ++i) {
+                if (jumps[i] < 0) continue;
+
+                // -> right operand spans rpn from i up to its operator, terms repeated by relation chains
+                // are already evaluated and bodies of function literals are not run
+                side_effect = nullptr;
+                for (int j = i; j < jumps[i] && side_effect == nullptr; ++j) {
+                    if (rpn[j] >= 0 && std::find(rpn.begin(), rpn.begin() + j, rpn[j]) == rpn.begin() + j) {
+                        expr_node->terms[rpn[j]]->visit(find_side_effect, ast_nodes::dummy, ast_nodes::dummy, false);
+                    }
+                }
+
+                if (side_effect == nullptr) continue;
+
+                // -> relation chains repeat the shared term at the start of the right operand
+                std::string message;
+                if (std::find(rpn.begin(), rpn.begin() + i, rpn[i]) != rpn.begin() + i) {
+                    message = "Skipped when the comparison before it is false";
+                } else if (rpn[jumps[i]] == -1 - 'a') {
+                    message = "Skipped when the left operand of and is false";
+                } else {
+                    message = "Skipped when the left operand of or is true";
+                }
+                (*warnings) << std::format("Warning at line {}, pos {}:\n\t{}\n", side_effect->line,
+                                           side_effect->pos, message);
+            }
+        }
+
+        void analyze(ast_nodes::Node* tree, std::ostream* log = &std::cerr) {
+            warnings = log;
+            tree->visit(at_enter, ast_nodes::dummy, ast_nodes::dummy);
+        }
+    }
+}
+
+#endif // __ANALYZERS_SHORTCIRCUIT_INCLUDED__
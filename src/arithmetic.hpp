@@ -1,38 +1,634 @@
 #ifndef __ARITHMETIC_INCLUDED__
 #define __ARITHMETIC_INCLUDED__
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <stack>
 #include <stdexcept>
 #include <map>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 
 #include "ast_lib.hpp"
+#include "pool.hpp"
+
+namespace ast_nodes {
+    struct scopeinfo;
+}
 
 namespace arithmetic {
-    struct AmbiguousVariable {
-        char type = 'e';
-        long long int_val;
-        long double real_val;
-        bool bool_val;
-        std::string string_val;
-        std::unordered_map<long long, long long> array_identifiers;
-        std::unordered_map<std::string, long long> tuple_identifiers;
-        std::vector<AmbiguousVariable*> array_values;
+    struct Value;
+
+    using CellVector = std::vector<Value*, pool::allocator<Value*>>;
+    using IndexMap = std::unordered_map<long long, Value*, std::hash<long long>, std::equal_to<long long>,
+            pool::allocator<std::pair<const long long, Value*>>>;
+    using FieldMap = std::unordered_map<std::string, long long, std::hash<std::string>, std::equal_to<std::string>,
+            pool::allocator<std::pair<const std::string, long long>>>;
+    using WordVector = std::vector<unsigned long long, pool::allocator<unsigned long long>>;
+
+    // Header of every object owned by the garbage collector
+    struct Object {
+        unsigned int mark = 0;
+        // Set once more than one value refers to the object, the first holder to change it makes its own copy
+        bool shared = false;
+        // Element cells of aggregates may be referenced from outside, such objects are not shared but copied
+        bool aliased = true;
+
+        static void* operator new(size_t size) {
+            return pool::allocate(size);
+        }
+
+        static void operator delete(void* memory, size_t size) {
+            pool::deallocate(memory, size);
+        }
+    };
+
+    // Ropes are concatenations kept as their two parts until the characters are needed, then value
+    // takes their text and the parts are dropped
+    struct String: Object {
+        std::string value;
+        String* left = nullptr;
+        String* right = nullptr;
+        // Length of a rope, flat strings have the one of value
+        size_t length = 0;
+    };
+
+    // Elements 1..dense.size() are kept in order, any other index lives in sparse
+    struct Array: Object {
+        CellVector dense;
+        IndexMap sparse;
+        // Largest positive index present
+        long long length = 0;
+        // Views hold no elements but show offset + 1 .. offset + length of base, they stay shared
+        // and base never changes, so they are duplicated before anything changes them
+        Array* base = nullptr;
+        long long offset = 0;
+        // Arrays of ints, reals or bools only may keep them unboxed: packing is their type, words hold
+        // elements 1..length (a bit each for bools) and present has a bit set for each element that is there.
+        // Packed arrays have no cells, whatever needs one unpacks them first
+        char packing = 0;
+        WordVector words;
+        WordVector present;
+
+        Value* find(long long index) const {
+            if (index >= 1 && index <= dense.size()) return dense[index - 1];
+            if (base != nullptr) return index >= 1 && index <= length ? base->find(offset + index) : nullptr;
+            if (sparse.empty()) return nullptr;
+            auto found = sparse.find(index);
+            return found == sparse.end() ? nullptr : found->second;
+        }
+
+        // Binds index to cell, replacing the element that was there
+        void insert(long long index, Value* cell) {
+            if (index >= 1 && index <= dense.size()) {
+                dense[index - 1] = cell;
+            } else if (index == dense.size() + 1) {
+                dense.push_back(cell);
+                // -> indices that were sparse become dense once the gap before them is filled
+                while (!sparse.empty()) {
+                    auto next = sparse.find(dense.size() + 1);
+                    if (next == sparse.end()) break;
+                    dense.push_back(next->second);
+                    sparse.erase(next);
+                }
+            } else {
+                sparse[index] = cell;
+            }
+            length = std::max(length, index);
+        }
+
+        template<typename F>
+        void for_each(F f) const {
+            if (base != nullptr) {
+                for (long long i = 1; i <= length; ++i) {
+                    Value* cell = base->find(offset + i);
+                    if (cell != nullptr) f(i, cell);
+                }
+                return;
+            }
+            for (size_t i = 0; i < dense.size(); ++i) {
+                f((long long) i + 1, dense[i]);
+            }
+            for (const auto& [index, cell]: sparse) {
+                f(index, cell);
+            }
+        }
+    };
+
+    // Field layouts of tuples, interned so that tuples with the same names in the same positions share
+    // one: each shape is found through the transitions of the shape with its last position removed.
+    // Shapes live as long as the program
+    struct Shape {
+        // Slot of each named position
+        FieldMap fields;
+        long long size = 0;
+        // Shape without the last position and the name of that position, empty if it is unnamed
+        Shape* parent = nullptr;
+        std::string name;
+        std::unordered_map<std::string, Shape*> transitions;
+        // Shapes of concatenations with this shape on the left
+        std::unordered_map<Shape*, Shape*> concatenations;
+    };
+
+    // Shape of tuples with no positions
+    Shape root_shape;
+
+    struct Tuple: Object {
+        Shape* shape = &root_shape;
+        CellVector array_values;
+    };
+
+    struct Function: Object {
         ast_nodes::FunctionNode* function_pointer;
-        std::unordered_map<std::string, AmbiguousVariable*> function_scope;
+        ast_nodes::scopeinfo* function_scope;
+    };
+
+    // Scalars are stored inline, strings, aggregates and closures behind a single pointer
+    struct Value {
+        char type = 'e';
+        // Only meaningful for variable cells, fits into the padding after the tag
+        unsigned int mark = 0;
+        union {
+            long long int_val = 0;
+            double real_val;
+            bool bool_val;
+            String* string_val;
+            Array* array_val;
+            Tuple* tuple_val;
+            Function* function_val;
+        };
+
+        static void* operator new(size_t size) {
+            return pool::allocate(size);
+        }
+
+        static void operator delete(void* memory, size_t size) {
+            pool::deallocate(memory, size);
+        }
     };
 
-    long long array_length(const std::unordered_map<long long, long long>& myMap) {
-        long long len = 0;
-        for (const auto& pair: myMap) {
-            if (pair.first > len) {
-                len = pair.first;
+    static_assert(sizeof(Value) == 16);
+
+    // Every object allocated during execution, objects not marked in the current epoch are garbage
+    struct Heap {
+        std::vector<Value*> cells;
+        std::vector<String*> strings;
+        std::vector<Array*> arrays;
+        std::vector<Tuple*> tuples;
+        std::vector<Function*> functions;
+
+        std::vector<Value*> cell_work;
+        std::vector<String*> string_work;
+        std::vector<ast_nodes::scopeinfo*> scope_work;
+
+        unsigned int epoch = 0;
+
+        size_t bytes = 0;
+        size_t threshold = 4 << 20;
+        size_t min_threshold = 4 << 20;
+
+        long long collections = 0;
+        long long pause_us = 0;
+        long long max_pause_us = 0;
+        size_t reclaimed = 0;
+    };
+
+    Heap heap;
+
+    size_t size_of(const Value*) {
+        return sizeof(Value);
+    }
+
+    size_t size_of(const String* string) {
+        return sizeof(String) + string->value.capacity();
+    }
+
+    size_t size_of(const Array* array) {
+        return sizeof(Array) + array->dense.capacity() * sizeof(Value*) +
+               array->sparse.size() * 2 * sizeof(long long) +
+               (array->words.capacity() + array->present.capacity()) * sizeof(unsigned long long);
+    }
+
+    size_t size_of(const Tuple* tuple) {
+        return sizeof(Tuple) + tuple->array_values.capacity() * sizeof(Value*);
+    }
+
+    size_t size_of(const Function*) {
+        return sizeof(Function);
+    }
+
+    template<typename T>
+    T* track(T* object, std::vector<T*>& objects) {
+        objects.push_back(object);
+        heap.bytes += size_of(object);
+        return object;
+    }
+
+    Value* new_cell() {
+        return track(new Value(), heap.cells);
+    }
+
+    Value* new_cell(const Value& value) {
+        return track(new Value(value), heap.cells);
+    }
+
+    String* new_string(const std::string& value) {
+        String* string = new String();
+        string->value = value;
+        return track(string, heap.strings);
+    }
+
+    size_t string_length(const String* string) {
+        return string->left != nullptr ? string->length : string->value.size();
+    }
+
+    // Characters of a string, a rope is flattened the first time they are needed
+    const std::string& text(String* string) {
+        if (string->left == nullptr) return string->value;
+
+        std::string result;
+        result.reserve(string->length);
+        std::vector<const String*> pending = {string->right, string->left};
+        while (!pending.empty()) {
+            const String* part = pending.back();
+            pending.pop_back();
+            if (part->left != nullptr) {
+                pending.push_back(part->right);
+                pending.push_back(part->left);
+            } else {
+                result += part->value;
+            }
+        }
+
+        string->value = std::move(result);
+        string->left = nullptr;
+        string->right = nullptr;
+        heap.bytes += string->value.capacity();
+        return string->value;
+    }
+
+    // Parts are frozen, whoever changes them in place gets a copy instead
+    String* new_rope(String* left, String* right) {
+        String* string = new String();
+        left->shared = true;
+        right->shared = true;
+        string->left = left;
+        string->right = right;
+        string->length = string_length(left) + string_length(right);
+        return track(string, heap.strings);
+    }
+
+    // Constants of literals and their strings are not tracked, so the collector never frees them.
+    // Strings of literals stay shared for good
+    String* new_immortal_string(const std::string& value) {
+        String* string = new String();
+        string->value = value;
+        string->shared = true;
+        return string;
+    }
+
+    Value* new_constant(const Value& value) {
+        return new Value(value);
+    }
+
+    Array* new_array(Array source = Array()) {
+        source.shared = false;
+        return track(new Array(std::move(source)), heap.arrays);
+    }
+
+    Tuple* new_tuple(Tuple source = Tuple()) {
+        source.shared = false;
+        return track(new Tuple(std::move(source)), heap.tuples);
+    }
+
+    // Shape with one more position named name (empty if unnamed) after those of shape, nullptr if shape
+    // already has a field with that name
+    Shape* extend(Shape* shape, const std::string& name) {
+        if (!name.empty() && shape->fields.count(name)) return nullptr;
+
+        Shape*& next = shape->transitions[name];
+        if (next == nullptr) {
+            next = new Shape();
+            next->fields = shape->fields;
+            if (!name.empty()) next->fields[name] = shape->size;
+            next->size = shape->size + 1;
+            next->parent = shape;
+            next->name = name;
+        }
+        return next;
+    }
+
+    // Shape of the concatenation of tuples shaped left and right, nullptr if they have a field name in common
+    Shape* concatenate(Shape* left, Shape* right) {
+        auto found = left->concatenations.find(right);
+        if (found != left->concatenations.end()) return found->second;
+
+        std::vector<const std::string*> names;
+        for (Shape* i = right; i->parent != nullptr; i = i->parent) {
+            names.push_back(&i->name);
+        }
+        Shape* result = left;
+        for (auto i = names.rbegin(); i != names.rend() && result != nullptr; ++i) {
+            result = extend(result, **i);
+        }
+        if (result != nullptr) left->concatenations[right] = result;
+        return result;
+    }
+
+    // Slot of the field name, -1 if shape has no such field
+    long long find_field(const Shape* shape, const std::string& name) {
+        auto field = shape->fields.find(name);
+        return field == shape->fields.end() ? -1 : field->second;
+    }
+
+    Function* new_function(ast_nodes::FunctionNode* pointer, ast_nodes::scopeinfo* scope) {
+        Function* function = new Function();
+        function->function_pointer = pointer;
+        function->function_scope = scope;
+        return track(function, heap.functions);
+    }
+
+    // Functions of builtins are not tracked either, they exist for the whole run
+    Function* new_builtin_function(ast_nodes::FunctionNode* pointer) {
+        Function* function = new Function();
+        function->function_pointer = pointer;
+        function->function_scope = nullptr;
+        return function;
+    }
+
+    void set_gc_threshold(size_t bytes) {
+        heap.threshold = bytes;
+        heap.min_threshold = bytes;
+    }
+
+    bool collection_due() {
+        return heap.bytes > heap.threshold;
+    }
+
+    void mark_cell(Value* cell) {
+        if (cell->mark != heap.epoch) {
+            cell->mark = heap.epoch;
+            heap.cell_work.push_back(cell);
+        }
+    }
+
+    // Parts of ropes are queued, ropes built piece by piece are too deep to recurse into
+    void mark_string(String* string) {
+        heap.string_work.push_back(string);
+        while (!heap.string_work.empty()) {
+            String* i = heap.string_work.back();
+            heap.string_work.pop_back();
+            if (i->mark == heap.epoch) continue;
+            i->mark = heap.epoch;
+            if (i->left != nullptr) {
+                heap.string_work.push_back(i->left);
+                heap.string_work.push_back(i->right);
             }
         }
-        return len;
+    }
+
+    // Views keep all of their base alive
+    void mark_array(Array* array) {
+        if (array->mark == heap.epoch) return;
+        array->mark = heap.epoch;
+        if (array->base != nullptr) {
+            mark_array(array->base);
+        } else {
+            array->for_each([](long long, Value* i) { mark_cell(i); });
+        }
+    }
+
+    // Marks the objects a value points to, cells of containers are queued instead of recursing
+    void mark(const Value& value) {
+        switch (value.type) {
+            case 's':
+                mark_string(value.string_val);
+                break;
+            case 'a':
+                mark_array(value.array_val);
+                break;
+            case 't':
+                if (value.tuple_val->mark != heap.epoch) {
+                    value.tuple_val->mark = heap.epoch;
+                    for (auto i: value.tuple_val->array_values) mark_cell(i);
+                }
+                break;
+            case 'f':
+                if (value.function_val->mark != heap.epoch) {
+                    value.function_val->mark = heap.epoch;
+                    heap.scope_work.push_back(value.function_val->function_scope);
+                }
+                break;
+        }
+    }
+
+    void mark_cells() {
+        while (!heap.cell_work.empty()) {
+            Value* cell = heap.cell_work.back();
+            heap.cell_work.pop_back();
+            mark(*cell);
+        }
+    }
+
+    template<typename T>
+    void sweep(std::vector<T*>& objects, size_t& live) {
+        size_t kept = 0;
+        for (auto i: objects) {
+            if (i->mark == heap.epoch) {
+                live += size_of(i);
+                objects[kept++] = i;
+            } else {
+                heap.reclaimed += size_of(i);
+                delete i;
+            }
+        }
+        objects.resize(kept);
+    }
+
+    // Frees everything that was not marked, returns the amount of bytes still in use
+    size_t sweep() {
+        size_t live = 0;
+        sweep(heap.cells, live);
+        sweep(heap.strings, live);
+        sweep(heap.arrays, live);
+        sweep(heap.tuples, live);
+        sweep(heap.functions, live);
+        return live;
+    }
+
+    void print_gc_stats(std::ostream& out) {
+        out << std::format("gc: {} collections, {} us total pause, {} us max pause, {} bytes reclaimed, {} bytes live",
+                           heap.collections, heap.pause_us, heap.max_pause_us, heap.reclaimed, heap.bytes)
+            << std::endl;
+    }
+
+    long long array_length(const Array* array) {
+        return array->length;
+    }
+
+    // Bits of packed bools and of present, index counts from 1
+    bool test_bit(const WordVector& bits, long long index) {
+        return bits[(index - 1) / 64] >> ((index - 1) % 64) & 1;
+    }
+
+    void set_bit(WordVector& bits, long long index, bool value) {
+        unsigned long long mask = 1ull << ((index - 1) % 64);
+        if (value) {
+            bits[(index - 1) / 64] |= mask;
+        } else {
+            bits[(index - 1) / 64] &= ~mask;
+        }
+    }
+
+    // 64 bits of bits starting at bit at, counting from 0
+    unsigned long long read_bits(const WordVector& bits, long long at) {
+        size_t word = at / 64;
+        int shift = at % 64;
+        unsigned long long low = word < bits.size() ? bits[word] >> shift : 0;
+        unsigned long long high = shift != 0 && word + 1 < bits.size() ? bits[word + 1] << (64 - shift) : 0;
+        return low | high;
+    }
+
+    // Ors count bits of source starting at bit from into target starting at bit to, a word at a time
+    void copy_bits(WordVector& target, long long to, const WordVector& source, long long from, long long count) {
+        for (long long k = 0; k < count; k += 64) {
+            unsigned long long chunk = read_bits(source, from + k);
+            if (count - k < 64) chunk &= (1ull << (count - k)) - 1;
+            size_t word = (to + k) / 64;
+            int shift = (to + k) % 64;
+            target[word] |= chunk << shift;
+            if (shift != 0 && word + 1 < target.size()) target[word + 1] |= chunk >> (64 - shift);
+        }
+    }
+
+    // Value of element index of a packed array, false if it is missing
+    bool packed_element(const Array& array, long long index, Value& element) {
+        if (index < 1 || index > array.length || !test_bit(array.present, index)) return false;
+        element.type = array.packing;
+        switch (array.packing) {
+            case 'i':
+                element.int_val = (long long) array.words[index - 1];
+                break;
+            case 'r':
+                element.real_val = std::bit_cast<double>(array.words[index - 1]);
+                break;
+            case 'b':
+                element.bool_val = test_bit(array.words, index);
+                break;
+        }
+        return true;
+    }
+
+    // Value of element index, false if it is missing
+    bool element_value(const Array& array, long long index, Value& element) {
+        if (array.packing != 0) return packed_element(array, index, element);
+        Value* cell = array.find(index);
+        if (cell == nullptr) return false;
+        element = *cell;
+        return true;
+    }
+
+    // Calls f with the index and the value of every element, packed or not
+    template<typename F>
+    void for_each_value(const Array& array, F f) {
+        if (array.packing == 0) {
+            array.for_each([&f](long long index, Value* cell) { f(index, *cell); });
+            return;
+        }
+        Value element;
+        for (long long i = 1; i <= array.length; ++i) {
+            if (packed_element(array, i, element)) f(i, element);
+        }
+    }
+
+    // Makes room for index in the words of a packed array, which cover 1..length
+    void grow(Array* array, long long index) {
+        array->length = std::max(array->length, index);
+        size_t bit_words = (array->length + 63) / 64;
+        if (array->present.size() < bit_words) array->present.resize(bit_words);
+        size_t slots = array->packing == 'b' ? bit_words : array->length;
+        if (array->words.size() < slots) array->words.resize(slots);
+    }
+
+    // Writes value of the packing type of array at index
+    void place(Array* array, long long index, const Value& value) {
+        grow(array, index);
+        switch (array->packing) {
+            case 'i':
+                array->words[index - 1] = (unsigned long long) value.int_val;
+                break;
+            case 'r':
+                array->words[index - 1] = std::bit_cast<unsigned long long>(value.real_val);
+                break;
+            case 'b':
+                set_bit(array->words, index, value.bool_val);
+                break;
+        }
+        set_bit(array->present, index, true);
+    }
+
+    // Arrays whose largest index is far past their element count would mostly hold unused words
+    bool dense_enough(long long length, long long count) {
+        return length <= 2 * count + 64;
+    }
+
+    // Packed arrays and arrays with no elements, which have no cells anything could refer to
+    bool takes_unboxed(const Array& array) {
+        return array.packing != 0 || (array.base == nullptr && array.dense.empty() && array.sparse.empty());
+    }
+
+    // Stores value at index of array without boxing it, false if it can not be kept packed
+    bool packed_store(Array* array, long long index, const Value& value) {
+        if (value.type != 'i' && value.type != 'r' && value.type != 'b') return false;
+        if (index < 1 || !dense_enough(index, array->length) || !takes_unboxed(*array)) return false;
+
+        if (array->packing == 0) {
+            array->packing = value.type;
+            array->aliased = false;
+        } else if (array->packing != value.type) {
+            return false;
+        }
+
+        place(array, index, value);
+        return true;
+    }
+
+    // Gives every element of a packed array a cell of its own
+    void unpack(Array* array) {
+        if (array->packing == 0) return;
+
+        Value element;
+        array->dense.reserve(array->length);
+        for (long long i = 1; i <= array->length; ++i) {
+            if (packed_element(*array, i, element)) array->insert(i, new_cell(element));
+        }
+        array->packing = 0;
+        WordVector().swap(array->words);
+        WordVector().swap(array->present);
+    }
+
+    // Type of the elements of an array that can be packed, 0 if it has other elements or too many holes
+    char packing_of(const Array& array) {
+        if (array.packing != 0) return array.packing;
+
+        char type = 0;
+        bool uniform = true;
+        long long count = 0;
+        array.for_each([&](long long index, Value* cell) {
+            if (type == 0) type = cell->type;
+            uniform = uniform && index >= 1 && cell->type == type;
+            ++count;
+        });
+        if (!uniform || (type != 'i' && type != 'r' && type != 'b') || !dense_enough(array.length, count)) return 0;
+        return type;
     }
 
     const std::unordered_map<char, std::string> type_names = {
@@ -65,10 +661,12 @@ namespace arithmetic {
         return init;
     }
 
-    std::ostream& operator<<(std::ostream& out, AmbiguousVariable& var) {
+
+    std::ostream& operator<<(std::ostream& out, const Value& var) {
         //out << var.type << std::endl;
         std::string s;
         bool first;
+        Value element;
         std::vector <std::string> ident;
         switch (var.type) {
             case 'i':
@@ -88,7 +686,7 @@ namespace arithmetic {
                 out << "empty";
                 break;
             case 's':
-                s = var.string_val;
+                s = text(var.string_val);
                 s = replace_substr(s, std::string("\\n"), std::string("\n"));
                 s = replace_substr(s, std::string("\\t"), std::string("\t"));
                 out << s;
@@ -96,14 +694,14 @@ namespace arithmetic {
             case 'a':
                 out << "[";
                 first = true;
-                for (int i = 1; i <= array_length(var.array_identifiers); ++i) {
+                for (long long i = 1; i <= array_length(var.array_val); ++i) {
                     if (first) {
                         first = false;
                     } else {
                         out << ", ";
                     }
-                    if (var.array_identifiers.count(i)) {
-                        out <<* var.array_values[var.array_identifiers[i]];
+                    if (element_value(*var.array_val, i, element)) {
+                        out << element;
                     } else {
                         out << "empty";
                     }
@@ -113,11 +711,11 @@ namespace arithmetic {
             case 't':
                 out << "{";
                 first = true;
-                ident.resize(var.array_values.size(), "");
-                for (auto& i: var.tuple_identifiers) {
-                    ident[i.second] = i.first;
+                ident.resize(var.tuple_val->array_values.size(), "");
+                for (Shape* i = var.tuple_val->shape; i->parent != nullptr; i = i->parent) {
+                    ident[i->size - 1] = i->name;
                 }
-                for (int i = 0; i < var.array_values.size(); ++i) {
+                for (int i = 0; i < var.tuple_val->array_values.size(); ++i) {
                     if (first) {
                         first = false;
                     } else {
@@ -125,9 +723,9 @@ namespace arithmetic {
                     }
 
                     if (ident[i] != "") {
-                        out << ident[i] << " := " <<* var.array_values[i];
+                        out << ident[i] << " := " << *var.tuple_val->array_values[i];
                     } else {
-                        out <<* var.array_values[i];
+                        out << *var.tuple_val->array_values[i];
                     }
                 }
                 out << "}";
@@ -135,7 +733,7 @@ namespace arithmetic {
             case 'f':
                 out << "func (";
                 first = true;
-                for (auto& i: var.function_pointer->params) {
+                for (auto& i: var.function_val->function_pointer->params) {
                     if (first) {
                         first = false;
                     } else {
@@ -153,43 +751,67 @@ namespace arithmetic {
     }
 
 
-    AmbiguousVariable* copy(AmbiguousVariable* var) {
-        AmbiguousVariable* c = new AmbiguousVariable();
+    Value copy(const Value& var);
+
+    // Duplicates of aggregates get cells of their own holding copies of the elements, nothing refers to those
+    // yet, so arrays of scalars of one type are packed instead unless the cells are wanted right away
+    Array* duplicate(const Array& source, bool pack = true) {
+        Array result;
+        result.aliased = false;
+        result.packing = pack ? packing_of(source) : 0;
+
+        if (result.packing != 0 && source.packing != 0) {
+            result.length = source.length;
+            result.words = source.words;
+            result.present = source.present;
+        } else if (result.packing != 0) {
+            source.for_each([&result](long long index, Value* i) { place(&result, index, *i); });
+        } else {
+            result.dense.reserve(source.packing != 0 ? source.length : source.dense.size());
+            for_each_value(source, [&result](long long index, const Value& i) {
+                result.insert(index, new_cell(copy(i)));
+            });
+        }
+        return new_array(std::move(result));
+    }
+
+    Tuple* duplicate(const Tuple& source) {
+        Tuple result;
+        result.aliased = false;
+        result.shape = source.shape;
+        result.array_values.reserve(source.array_values.size());
+        for (auto i: source.array_values) {
+            result.array_values.push_back(new_cell(copy(*i)));
+        }
+        return new_tuple(std::move(result));
+    }
 
-        c->type = var->type;
-        switch (var->type) {
+    // Copies refer to the same string or aggregate, which gets duplicated only once a holder changes it.
+    // Aggregates with aliased cells are duplicated right away
+    Value copy(const Value& var) {
+        Value c = var;
+        switch (var.type) {
             case 'i':
-                c->int_val = (long long) var->int_val;
-                break;
             case 'r':
-                c->real_val = (long double) var->real_val;
-                break;
             case 'b':
-                c->bool_val = (bool) var->bool_val;
-                break;
             case 'e':
+            case 'f':
                 break;
             case 's':
-                c->string_val = std::string(var->string_val.begin(), var->string_val.end());
+                var.string_val->shared = true;
                 break;
             case 'a':
-                c->array_identifiers = var->array_identifiers;
-                c->array_values.reserve(var->array_values.size());
-                for (auto& i: var->array_values) {
-                    c->array_values.push_back(copy(i));
+                if (var.array_val->aliased) {
+                    c.array_val = duplicate(*var.array_val);
+                } else {
+                    var.array_val->shared = true;
                 }
                 break;
             case 't':
-                c->tuple_identifiers = var->tuple_identifiers;
-                c->array_values.reserve(var->array_values.size());
-                for (auto& i: var->array_values) {
-                    c->array_values.push_back(copy(i));
-                }
-                break;
-            case 'f':
-                c->function_pointer = var->function_pointer;
-                for (auto i: var->function_scope) {
-                    c->function_scope[i.first] = copy(i.second);
+                if (var.tuple_val->aliased) {
+                    c.tuple_val = duplicate(*var.tuple_val);
+                } else {
+                    var.tuple_val->shared = true;
                 }
                 break;
             default:
@@ -198,718 +820,639 @@ namespace arithmetic {
         return c;
     }
 
-    bool tuple_conflicts(AmbiguousVariable* a, AmbiguousVariable* b) {
-        for (const auto& pair: a->tuple_identifiers) {
-            if (b->tuple_identifiers.find(pair.first) != b->tuple_identifiers.end()) {
-                return true;
-            }
+    // Gives holder its own duplicate of a shared string or aggregate before it gets changed
+    void make_private(Value& holder) {
+        switch (holder.type) {
+            case 's':
+                if (holder.string_val->shared) holder.string_val = new_string(text(holder.string_val));
+                break;
+            case 'a':
+                if (holder.array_val->shared) holder.array_val = duplicate(*holder.array_val);
+                break;
+            case 't':
+                if (holder.tuple_val->shared) holder.tuple_val = duplicate(*holder.tuple_val);
+                break;
         }
-        return false;
     }
 
-    AmbiguousVariable* tuple_addition(AmbiguousVariable* a, AmbiguousVariable* b) {
-        long long vec_size = a->array_values.size();
-        if (tuple_conflicts(a, b)) {
-            throw std::runtime_error("Impossible to concatenate two tuples because they have the same key");
-        }
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 't';
-        c->array_values.insert(c->array_values.end(), a->array_values.begin(), a->array_values.end());
-        c->array_values.insert(c->array_values.end(), b->array_values.begin(), b->array_values.end());
-        std::unordered_map<std::string, long long> concatenated_map;
-        for (const auto& [key, value]: a->tuple_identifiers) {
-            concatenated_map[key] = value;
+    // Element cells of holder are about to be referenced from outside
+    void expose(Value& holder) {
+        if (holder.type == 'a') {
+            if (holder.array_val->shared) holder.array_val = duplicate(*holder.array_val, false);
+            unpack(holder.array_val);
+            holder.array_val->aliased = true;
+            return;
         }
-
-        for (const auto& [key, value]: b->tuple_identifiers) {
-            concatenated_map[key] = vec_size + value;
-        }
-        c->tuple_identifiers = concatenated_map;
-        return c;
+        make_private(holder);
+        if (holder.type == 't') holder.tuple_val->aliased = true;
     }
 
-    AmbiguousVariable* array_addition(AmbiguousVariable* a, AmbiguousVariable* b) {
-        long long length_of_array = array_length(a->array_identifiers);
-        long long vec_size = a->array_values.size();
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'a';
-        c->array_values.insert(c->array_values.end(), a->array_values.begin(), a->array_values.end());
-        c->array_values.insert(c->array_values.end(), b->array_values.begin(), b->array_values.end());
-        std::unordered_map<long long, long long> concatenated_map;
-
-        for (const auto& [key, value]: a->array_identifiers) {
-            concatenated_map[key] = value;
-        }
-
-        for (const auto& [key, value]: b->array_identifiers) {
-            concatenated_map[length_of_array + key] = vec_size + value;
+    bool is_shared(const Value& var) {
+        switch (var.type) {
+            case 's':
+                return var.string_val->shared;
+            case 'a':
+                return var.array_val->shared;
+            case 't':
+                return var.tuple_val->shared;
         }
-        c->array_identifiers = concatenated_map;
-        return c;
+        return false;
     }
 
-    AmbiguousVariable* op_addition(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'i';
-                        c->int_val = a->int_val + b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->int_val + b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'r';
-                        c->real_val = a->real_val + b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->real_val + b->real_val;
-                        return c;
-                }
-                break;
+    // Elements looked at through a shared aggregate are shared along with it
+    void share_element(const Value& holder, const Value& element) {
+        if (!is_shared(holder)) return;
+        switch (element.type) {
             case 's':
-                switch (b->type) {
-                    case 's':
-                        c->type = 's';
-                        c->string_val = a->string_val + b->string_val;
-                        return c;
-                }
-                break;
-            case 't':
-                switch (b->type) {
-                    case 't':
-                        c = tuple_addition(a, b);
-                        return c;
-                }
+                element.string_val->shared = true;
                 break;
             case 'a':
-                switch (b->type) {
-                    case 'a':
-                        c = array_addition(a, b);
-                        return c;
-                }
+                element.array_val->shared = true;
+                break;
+            case 't':
+                element.tuple_val->shared = true;
                 break;
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for addition: {} and {}", get_name(a->type), get_name(b->type)));
     }
 
-
-    AmbiguousVariable* op_subtraction(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'i';
-                        c->int_val = a->int_val - b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->int_val - b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'r';
-                        c->real_val = a->real_val - b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->real_val - b->real_val;
-                        return c;
-                }
-                break;
+    // Assigning to a missing index of an array creates it, packed arrays get their cells first
+    Value* array_element(Array* array, long long index) {
+        unpack(array);
+        Value* cell = array->find(index);
+        if (cell == nullptr) {
+            cell = new_cell();
+            array->insert(index, cell);
         }
-        throw std::runtime_error(std::format("Unsupported operand type for subtraction: {} and {}", get_name(a->type),
-                                             get_name(b->type)));
+        return cell;
     }
 
-    AmbiguousVariable* op_plus_equality(AmbiguousVariable* a, AmbiguousVariable* b) {
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        a->int_val = a->int_val + b->int_val;
-                        return a;
-                    case 'r':
-                        a->type = 'r';
-                        a->real_val = a->int_val + b->real_val;
-                        return a;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        a->real_val = a->real_val + b->int_val;
-                        return a;
-                    case 'r':
-                        a->real_val = a->real_val + b->real_val;
-                        return a;
-                }
-                break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        a->string_val = a->string_val + b->string_val;
-                        return a;
-                }
-                break;
-            case 't':
-                switch (b->type) {
-                    case 't':
-                       * a =* tuple_addition(a, b);
-                        return a;
-                }
-                break;
-            case 'a':
-                switch (b->type) {
-                    case 'a':
-                       * a =* array_addition(a, b);
-                        return a;
-                }
-                break;
+    // Prepares a store into element index made once the assigned value is known: the cell to assign to, or
+    // nullptr if the value may stay unboxed. Meanwhile the element counts as there, as it would with a cell
+    Value* store_target(Array* array, long long index) {
+        if (!takes_unboxed(*array) || index < 1 || !dense_enough(index, array->length)) {
+            return array_element(array, index);
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for addition: {} and {}", get_name(a->type), get_name(b->type)));
+        if (array->packing != 0) {
+            grow(array, index);
+        } else {
+            array->length = std::max(array->length, index);
+        }
+        return nullptr;
     }
 
+    // Copies the words of elements from .. to of a packed array, false if some of them are missing
+    bool packed_slice(const Array& array, long long from, long long to, Value& result) {
+        if (from < 1 || to > array.length) return false;
 
-    AmbiguousVariable* op_minus_equality(AmbiguousVariable* a, AmbiguousVariable* b) {
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        a->int_val = a->int_val - b->int_val;
-                        return a;
-                    case 'r':
-                        a->type = 'r';
-                        a->real_val = a->int_val - b->real_val;
-                        return a;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        a->real_val = a->real_val - b->int_val;
-                        return a;
-                    case 'r':
-                        a->real_val = a->real_val - b->real_val;
-                        return a;
-                }
-                break;
+        Array result_array;
+        result_array.aliased = false;
+        result_array.packing = array.packing;
+        result_array.length = to - from + 1;
+        result_array.present.resize((result_array.length + 63) / 64);
+        copy_bits(result_array.present, 0, array.present, from - 1, result_array.length);
+
+        long long count = 0;
+        for (auto i: result_array.present) count += std::popcount(i);
+        if (count != result_array.length) return false;
+
+        if (array.packing == 'b') {
+            result_array.words.resize(result_array.present.size());
+            copy_bits(result_array.words, 0, array.words, from - 1, result_array.length);
+        } else {
+            result_array.words.assign(array.words.begin() + (from - 1), array.words.begin() + to);
         }
-        throw std::runtime_error(std::format("Unsupported operand type for subtraction: {} and {}", get_name(a->type),
-                                             get_name(b->type)));
+        result.array_val = new_array(std::move(result_array));
+        return true;
     }
 
-    AmbiguousVariable* op_multiplication(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'i';
-                        c->int_val = a->int_val*  b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->int_val*  b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'r';
-                        c->real_val = a->real_val*  b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->real_val*  b->real_val;
-                        return c;
-                }
-                break;
+    // Elements from .. to of source, false if the bounds are not integers or source is not an array.
+    // Complete ranges of arrays whose cells are private are shown through a view instead of being copied
+    bool array_slice(const Value& source, const Value& from, const Value& to, Value& result) {
+        if (from.type != 'i' || to.type != 'i') return false;
+
+        result.type = 'a';
+        if (from.int_val > to.int_val) {
+            result.array_val = new_array();
+            return true;
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for multiplication: {} and {}", get_name(a->type),
-                            get_name(b->type)));
-    }
+        if (source.type != 'a') return false;
 
+        Array* array = source.array_val;
+        if (array->packing != 0 && packed_slice(*array, from.int_val, to.int_val, result)) return true;
 
-    AmbiguousVariable* op_division(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'i';
-                        c->int_val = a->int_val / b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->int_val / b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->type = 'r';
-                        c->real_val = a->real_val / b->int_val;
-                        return c;
-                    case 'r':
-                        c->type = 'r';
-                        c->real_val = a->real_val / b->real_val;
-                        return c;
-                }
-                break;
+        Array* base = array->base != nullptr ? array->base : array;
+        long long first = array->offset + from.int_val;
+        long long last = array->offset + to.int_val;
+
+        // -> dense ranges of the base are complete, anything else is looked up one by one
+        bool complete = array->base == nullptr || (from.int_val >= 1 && to.int_val <= array->length);
+        if (complete && (first < 1 || last > base->dense.size())) {
+            for (long long i = from.int_val; i <= to.int_val && complete; ++i) {
+                complete = array->find(i) != nullptr;
+            }
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for division: {} and {}", get_name(a->type), get_name(b->type)));
-    }
 
-    AmbiguousVariable* op_lt(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->int_val < b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->int_val < b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->real_val < b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->real_val < b->real_val;
-                        return c;
-                }
-                break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        c->bool_val = a->string_val < b->string_val;
-                        return a;
-                }
-                break;
+        // -> missing elements read as empty
+        if (array->aliased || !complete) {
+            Array result_array;
+            result_array.aliased = false;
+            result_array.dense.reserve(to.int_val - from.int_val + 1);
+            Value element;
+            for (long long i = from.int_val; i <= to.int_val; ++i) {
+                result_array.insert(i - from.int_val + 1,
+                                    element_value(*array, i, element) ? new_cell(copy(element)) : new_cell());
+            }
+            result.array_val = new_array(std::move(result_array));
+            return true;
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for <: {} and {}", get_name(a->type), get_name(b->type)));
+
+        array->shared = true;
+        base->shared = true;
+        Array view;
+        view.aliased = false;
+        view.base = base;
+        view.offset = first - 1;
+        view.length = to.int_val - from.int_val + 1;
+        result.array_val = new_array(std::move(view));
+        result.array_val->shared = true;
+        return true;
     }
 
-    AmbiguousVariable* op_gt(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->int_val > b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->int_val > b->real_val;
-                        return c;
-                }
+    // Assigned strings are shared, containers are duplicated with their element cells staying shared
+    void assign(Value* target, Value& source) {
+        if (source.type == 'a' || source.type == 't') expose(source);
+        Value c = source;
+
+        switch (source.type) {
+            case 's':
+                source.string_val->shared = true;
                 break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->real_val > b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->real_val > b->real_val;
-                        return c;
-                }
+            case 'a':
+                c.array_val = new_array(*source.array_val);
                 break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        c->bool_val = a->string_val > b->string_val;
-                        return a;
-                }
+            case 't':
+                c.tuple_val = new_tuple(*source.tuple_val);
                 break;
         }
+        *target = c;
+    }
 
-        throw std::runtime_error(
-                std::format("Unsupported operand type for >: {} and {}", get_name(a->type), get_name(b->type)));
+    Value tuple_addition(const Value& a, const Value& b) {
+        Tuple result;
+        result.shape = concatenate(a.tuple_val->shape, b.tuple_val->shape);
+        if (result.shape == nullptr) {
+            throw std::runtime_error("Impossible to concatenate two tuples because they have the same key");
+        }
+        CellVector& values = result.array_values;
+        values.reserve(a.tuple_val->array_values.size() + b.tuple_val->array_values.size());
+        values.insert(values.end(), a.tuple_val->array_values.begin(), a.tuple_val->array_values.end());
+        values.insert(values.end(), b.tuple_val->array_values.begin(), b.tuple_val->array_values.end());
+        Value c;
+        c.type = 't';
+        c.tuple_val = new_tuple(std::move(result));
+        return c;
     }
 
-    AmbiguousVariable* op_lte(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->int_val <= b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->int_val <= b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->real_val <= b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->real_val <= b->real_val;
-                        return c;
-                }
-                break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        c->bool_val = a->string_val <= b->string_val;
-                        return a;
-                }
-                break;
+    // Elements of source are shared and placed after the last index of target
+    void array_append(Array* target, const Array& source) {
+        if (target == &source) {
+            Array same = source;
+            array_append(target, same);
+            return;
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for <=: {} and {}", get_name(a->type), get_name(b->type)));
+
+        long long length_of_array = array_length(target);
+
+        // -> packed elements have no cells to share, they get new ones
+        if (source.packing != 0) {
+            for_each_value(source, [target, length_of_array](long long index, const Value& element) {
+                target->insert(length_of_array + index, new_cell(element));
+            });
+            return;
+        }
+
+        source.for_each([target, length_of_array](long long index, Value* cell) {
+            // -> non-positive indices of the right operand can replace elements of the left one
+            target->insert(length_of_array + index, cell);
+        });
     }
 
-    AmbiguousVariable* op_gte(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
-        switch (a->type) {
-            case 'i':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->int_val >= b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->int_val >= b->real_val;
-                        return c;
-                }
-                break;
-            case 'r':
-                switch (b->type) {
-                    case 'i':
-                        c->bool_val = a->real_val >= b->int_val;
-                        return c;
-                    case 'r':
-                        c->bool_val = a->real_val >= b->real_val;
-                        return c;
-                }
-                break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        c->bool_val = a->string_val >= b->string_val;
-                        return a;
-                }
-                break;
+    // Packed arrays of the same type are joined by copying their words
+    Array packed_addition(const Array& left, const Array& right) {
+        Array result;
+        result.aliased = false;
+        result.packing = left.packing;
+        result.length = left.length + right.length;
+        result.present.resize((result.length + 63) / 64);
+        copy_bits(result.present, 0, left.present, 0, left.length);
+        copy_bits(result.present, left.length, right.present, 0, right.length);
+
+        if (left.packing == 'b') {
+            result.words.resize(result.present.size());
+            copy_bits(result.words, 0, left.words, 0, left.length);
+            copy_bits(result.words, left.length, right.words, 0, right.length);
+        } else {
+            result.words.reserve(result.length);
+            result.words.insert(result.words.end(), left.words.begin(), left.words.end());
+            result.words.insert(result.words.end(), right.words.begin(), right.words.end());
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for >=: {} and {}", get_name(a->type), get_name(b->type)));
+        return result;
     }
 
+    Value array_addition(const Value& a, const Value& b) {
+        const Array& left = *a.array_val;
+        const Array& right = *b.array_val;
+        Value c;
+        c.type = 'a';
 
-    AmbiguousVariable* op_eq(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
+        if (left.packing != 0 && left.packing == right.packing) {
+            c.array_val = new_array(packed_addition(left, right));
+            return c;
+        }
+
+        Array result;
+        if (left.packing != 0) {
+            array_append(&result, left);
+        } else {
+            result = left;
+        }
+        result.dense.reserve(result.dense.size() + (right.packing != 0 ? right.length : right.dense.size()));
+        array_append(&result, right);
+        c.array_val = new_array(std::move(result));
+        return c;
+    }
+
+    // Element cells of b end up in a
+    Value* op_plus_equality(Value* a, Value& b) {
+        if (b.type == 'a' || b.type == 't') {
+            expose(*a);
+            expose(b);
+        } else {
+            make_private(*a);
+        }
         switch (a->type) {
             case 'i':
-                switch (b->type) {
+                switch (b.type) {
                     case 'i':
-                        c->bool_val = a->int_val == b->int_val;
-                        return c;
+                        a->int_val = a->int_val + b.int_val;
+                        return a;
                     case 'r':
-                        c->bool_val = a->int_val == b->real_val;
-                        return c;
+                        a->type = 'r';
+                        a->real_val = a->int_val + b.real_val;
+                        return a;
                 }
                 break;
             case 'r':
-                switch (b->type) {
+                switch (b.type) {
                     case 'i':
-                        c->bool_val = a->real_val == b->int_val;
-                        return c;
+                        a->real_val = a->real_val + b.int_val;
+                        return a;
                     case 'r':
-                        c->bool_val = a->real_val == b->real_val;
-                        return c;
+                        a->real_val = a->real_val + b.real_val;
+                        return a;
                 }
                 break;
             case 's':
-                if (b->type == 's') {
-                    c->bool_val = a->string_val == b->string_val;
-                    return c;
+                switch (b.type) {
+                    case 's':
+                        text(a->string_val);
+                        a->string_val->value += text(b.string_val);
+                        return a;
                 }
                 break;
-            case 'b':
-                if (b->type == 'b') {
-                    c->bool_val = a->bool_val == b->bool_val;
-                    return c;
+            case 't':
+                switch (b.type) {
+                    case 't':
+                        *a = tuple_addition(*a, b);
+                        return a;
                 }
                 break;
             case 'a':
-                if (b->type == 'a') {
-                    try {
-                        for (auto i: a->array_identifiers) {
-                            if (b->array_identifiers.count(i.first)) {
-                                if (!op_eq(b->array_values[b->array_identifiers[i.first]],
-                                           a->array_values[i.second])->bool_val) {
-                                    c->bool_val = false;
-                                    return c;
-                                }
-                            } else if (a->array_values[i.second]->type != 'e') {
-                                c->bool_val = false;
-                                return c;
-                            }
-                        }
-
-                        for (auto i: b->array_identifiers) {
-                            if (a->array_identifiers.count(i.first)) {
-                                if (!op_eq(a->array_values[a->array_identifiers[i.first]],
-                                           b->array_values[i.second])->bool_val) {
-                                    c->bool_val = false;
-                                    return c;
-                                }
-                            } else if (b->array_values[i.second]->type != 'e') {
-                                c->bool_val = false;
-                                return c;
-                            }
-                        }
-
-                        c->bool_val = true;
-                        return c;
-                    } catch (std::runtime_error& ex) {
-                        c->bool_val = false;
-                        return c;
-                    }
-                }
-                break;
-            case 't':
-                if (b->type == 't') {
-                    try {
-                        if (a->tuple_identifiers.size() != b->tuple_identifiers.size() ||
-                            a->array_values.size() != b->array_values.size()) {
-                            c->bool_val = false;
-                            return c;
-                        }
-
-                        for (auto i: a->tuple_identifiers) {
-                            if (!b->tuple_identifiers.count(i.first) || b->tuple_identifiers[i.first] != i.second) {
-                                c->bool_val = false;
-                                return c;
-                            }
-                        }
-
-                        for (int i = 0; i < a->array_values.size(); ++i) {
-                            if (!op_eq(a->array_values[i], b->array_values[i])->bool_val) {
-                                c->bool_val = false;
-                                return c;
-                            }
-                        }
-
-                        c->bool_val = true;
-                        return c;
-                    } catch (std::runtime_error& ex) {
-                        c->bool_val = false;
-                        return c;
-                    }
+                switch (b.type) {
+                    case 'a':
+                        // -> arrays belong to a single cell, so the old value can be extended in place
+                        array_append(a->array_val, *b.array_val);
+                        return a;
                 }
                 break;
         }
         throw std::runtime_error(
-                std::format("Unsupported operand type for =: {} and {}", get_name(a->type), get_name(b->type)));
+                std::format("Unsupported operand type for addition: {} and {}", get_name(a->type), get_name(b.type)));
     }
 
-    AmbiguousVariable* op_ne(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        c->type = 'b';
+
+    Value* op_minus_equality(Value* a, const Value& b) {
         switch (a->type) {
             case 'i':
-                switch (b->type) {
+                switch (b.type) {
                     case 'i':
-                        c->bool_val = a->int_val != b->int_val;
-                        return c;
+                        a->int_val = a->int_val - b.int_val;
+                        return a;
                     case 'r':
-                        c->bool_val = a->int_val != b->real_val;
-                        return c;
+                        a->type = 'r';
+                        a->real_val = a->int_val - b.real_val;
+                        return a;
                 }
                 break;
             case 'r':
-                switch (b->type) {
+                switch (b.type) {
                     case 'i':
-                        c->bool_val = a->real_val != b->int_val;
-                        return c;
+                        a->real_val = a->real_val - b.int_val;
+                        return a;
                     case 'r':
-                        c->bool_val = a->real_val != b->real_val;
-                        return c;
-                }
-                break;
-            case 's':
-                switch (b->type) {
-                    case 's':
-                        c->bool_val = a->string_val != b->string_val;
-                        return c;
-                }
-                break;
-            case 'b':
-                switch (b->type) {
-                    case 'b':
-                        c->bool_val = a->bool_val != b->bool_val;
-                        return c;
-                }
-                break;
-            case 'a':
-                if (b->type == 'a') {
-                    try {
-                        for (auto i: a->array_identifiers) {
-                            if (b->array_identifiers.count(i.first)) {
-                                if (!op_eq(b->array_values[b->array_identifiers[i.first]],
-                                           a->array_values[i.second])->bool_val) {
-                                    c->bool_val = true;
-                                    return c;
-                                }
-                            } else if (a->array_values[i.second]->type != 'e') {
-                                c->bool_val = true;
-                                return c;
-                            }
-                        }
-
-                        for (auto i: b->array_identifiers) {
-                            if (a->array_identifiers.count(i.first)) {
-                                if (!op_eq(a->array_values[a->array_identifiers[i.first]],
-                                           b->array_values[i.second])->bool_val) {
-                                    c->bool_val = true;
-                                    return c;
-                                }
-                            } else if (b->array_values[i.second]->type != 'e') {
-                                c->bool_val = true;
-                                return c;
-                            }
-                        }
-
-                        c->bool_val = false;
-                        return c;
-                    } catch (std::runtime_error& ex) {
-                        c->bool_val = false;
-                        return c;
-                    }
-                }
-                break;
-            case 't':
-                if (b->type == 't') {
-                    try {
-                        if (a->tuple_identifiers.size() != b->tuple_identifiers.size() ||
-                            a->array_values.size() != b->array_values.size()) {
-                            c->bool_val = true;
-                            return c;
-                        }
-
-                        for (auto i: a->tuple_identifiers) {
-                            if (!b->tuple_identifiers.count(i.first) || b->tuple_identifiers[i.first] != i.second) {
-                                c->bool_val = true;
-                                return c;
-                            }
-                        }
-
-                        for (int i = 0; i < a->array_values.size(); ++i) {
-                            if (!op_eq(a->array_values[i], b->array_values[i])->bool_val) {
-                                c->bool_val = true;
-                                return c;
-                            }
-                        }
-
-                        c->bool_val = false;
-                        return c;
-                    } catch (std::runtime_error& ex) {
-                        c->bool_val = false;
-                        return c;
-                    }
+                        a->real_val = a->real_val - b.real_val;
+                        return a;
                 }
                 break;
         }
-        throw std::runtime_error(
-                std::format("Unsupported operand type for /=: {} and {}", get_name(a->type), get_name(b->type)));
+        throw std::runtime_error(std::format("Unsupported operand type for subtraction: {} and {}", get_name(a->type),
+                                             get_name(b.type)));
     }
 
+    // Dense codes of value types and binary operators, the dispatch table is indexed by them
+    enum TypeCode : unsigned char {
+        typeEmpty, typeInt, typeReal, typeBool, typeString, typeArray, typeTuple, typeFunction, type_count
+    };
+
+    enum OperatorCode : unsigned char {
+        binAdd, binSubtract, binMultiply, binDivide, binLess, binLessEqual, binGreater, binGreaterEqual,
+        binEqual, binNotEqual, binXor, binAnd, binOr, binUnknown, operator_count
+    };
+
+    // -> unknown tags fall into typeEmpty and binUnknown, which only have error kernels
+    constexpr std::array<unsigned char, 256> type_codes = [] {
+        std::array<unsigned char, 256> codes{};
+        codes['i'] = typeInt;
+        codes['r'] = typeReal;
+        codes['b'] = typeBool;
+        codes['s'] = typeString;
+        codes['a'] = typeArray;
+        codes['t'] = typeTuple;
+        codes['f'] = typeFunction;
+        return codes;
+    }();
+
+    constexpr std::array<unsigned char, 256> operator_codes = [] {
+        std::array<unsigned char, 256> codes{};
+        codes.fill(binUnknown);
+        codes['+'] = binAdd;
+        codes['-'] = binSubtract;
+        codes['*'] = binMultiply;
+        codes['/'] = binDivide;
+        codes['<'] = binLess;
+        codes['l'] = binLessEqual;
+        codes['>'] = binGreater;
+        codes['m'] = binGreaterEqual;
+        codes['='] = binEqual;
+        codes['n'] = binNotEqual;
+        codes['x'] = binXor;
+        codes['a'] = binAnd;
+        codes['o'] = binOr;
+        return codes;
+    }();
+
+    constexpr const char* operator_names[operator_count] = {
+            "addition", "subtraction", "multiplication", "division", "<", "<=", ">", ">=", "=", "/=",
+            "xor", "and", "or", "?"
+    };
+
+    using BinaryKernel = Value (*)(const Value&, const Value&);
 
-    AmbiguousVariable* op_xor(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        if (!(a->type == 'b' and b->type == 'b')) {
-            throw std::runtime_error("xor is possible only with two boolean arguments");
+    template<OperatorCode Op>
+    Value unsupported(const Value& a, const Value& b) {
+        if constexpr (Op == binUnknown) {
+            throw std::runtime_error("Unknown operator");
+        } else if constexpr (Op == binXor || Op == binAnd || Op == binOr) {
+            throw std::runtime_error(std::format("{} is possible only with two boolean arguments", operator_names[Op]));
+        } else {
+            throw std::runtime_error(std::format("Unsupported operand type for {}: {} and {}", operator_names[Op],
+                                                 get_name(a.type), get_name(b.type)));
         }
-        c->type = 'b';
-        c->bool_val = a->bool_val xor b->bool_val;
-        return c;
     }
 
+    template<char Type>
+    auto payload(const Value& value) {
+        if constexpr (Type == 'i') return value.int_val;
+        else if constexpr (Type == 'r') return value.real_val;
+        else if constexpr (Type == 'b') return value.bool_val;
+        else return std::string_view(text(value.string_val));
+    }
 
-    AmbiguousVariable* op_and(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        if (!(a->type == 'b' and b->type == 'b')) {
-            throw std::runtime_error("and is possible only with two boolean arguments");
+    template<typename T>
+    Value result_value(T result) {
+        Value c;
+        if constexpr (std::is_same_v<T, bool>) {
+            c.type = 'b';
+            c.bool_val = result;
+        } else if constexpr (std::is_same_v<T, double>) {
+            c.type = 'r';
+            c.real_val = result;
+        } else {
+            c.type = 'i';
+            c.int_val = result;
         }
-        c->type = 'b';
-        c->bool_val = a->bool_val and b->bool_val;
         return c;
     }
 
-    AmbiguousVariable* op_or(AmbiguousVariable* a, AmbiguousVariable* b) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        if (!(a->type == 'b' and b->type == 'b')) {
-            throw std::runtime_error("or is possible only with two boolean arguments");
+    // Applies F to the payloads of two scalars (or string views), the result type follows from F
+    template<typename F, char Left, char Right>
+    Value scalar_kernel(const Value& a, const Value& b) {
+        return result_value(F{}(payload<Left>(a), payload<Right>(b)));
+    }
+
+    struct logical_xor {
+        bool operator()(bool a, bool b) const {
+            return a != b;
+        }
+    };
+
+    // Results up to this length are flat, longer ones are ropes
+    const size_t flat_limit = 256;
+
+    // -> short pieces meeting at the joint of a rope are merged into one part, so strings built a few
+    // characters at a time keep parts of about flat_limit characters instead of one per piece
+    Value string_addition(const Value& a, const Value& b) {
+        String* left = a.string_val;
+        String* right = b.string_val;
+        Value c;
+        c.type = 's';
+
+        if (string_length(left) + string_length(right) <= flat_limit) {
+            c.string_val = new_string(text(left) + text(right));
+        } else if (left->left != nullptr && string_length(left->right) + string_length(right) <= flat_limit) {
+            c.string_val = new_rope(left->left, new_string(text(left->right) + text(right)));
+        } else if (right->left != nullptr && string_length(left) + string_length(right->left) <= flat_limit) {
+            c.string_val = new_rope(new_string(text(left) + text(right->left)), right->right);
+        } else {
+            c.string_val = new_rope(left, right);
         }
-        c->type = 'b';
-        c->bool_val = a->bool_val or b->bool_val;
         return c;
     }
 
+    Value apply_operator(const Value& a, const Value& b, const char& op);
+
+    // Packed arrays of the same type hold the same elements when their words match, reals are compared
+    // as numbers so that 0.0 and -0.0 are equal and nan is not. The loops have no early exit to stay vectorizable
+    bool same_words(const Array& left, const Array& right) {
+        if (left.length != right.length || left.present != right.present) return false;
+        if (left.packing != 'r') return left.words == right.words;
+
+        bool same = true;
+        for (size_t i = 0; i < left.words.size(); ++i) {
+            same &= std::bit_cast<double>(left.words[i]) == std::bit_cast<double>(right.words[i]);
+        }
+        return same;
+    }
+
+    // Indices present in only one of the arrays have to hold empty values
+    bool same_elements(const Array& left, const Array& right) {
+        if (left.packing != 0 && left.packing == right.packing) return same_words(left, right);
+
+        bool same = true;
+        Value other;
+        for_each_value(left, [&](long long index, const Value& element) {
+            if (!same) return;
+            if (element_value(right, index, other)) {
+                same = apply_operator(other, element, '=').bool_val;
+            } else {
+                same = element.type == 'e';
+            }
+        });
+        for_each_value(right, [&](long long index, const Value& element) {
+            if (!same) return;
+            if (!element_value(left, index, other)) same = element.type == 'e';
+        });
+        return same;
+    }
+
+    // -> tuples with the same names in the same positions have the same shape
+    bool same_fields(const Tuple& left, const Tuple& right) {
+        if (left.shape != right.shape) return false;
+
+        for (int i = 0; i < left.array_values.size(); ++i) {
+            if (!apply_operator(*left.array_values[i], *right.array_values[i], '=').bool_val) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Aggregates holding incomparable elements are reported unequal by both = and /=
+    template<bool Equal>
+    Value array_equality(const Value& a, const Value& b) {
+        try {
+            return result_value(same_elements(*a.array_val, *b.array_val) == Equal);
+        } catch (std::runtime_error& ex) {
+            return result_value(false);
+        }
+    }
+
+    template<bool Equal>
+    Value tuple_equality(const Value& a, const Value& b) {
+        try {
+            return result_value(same_fields(*a.tuple_val, *b.tuple_val) == Equal);
+        } catch (std::runtime_error& ex) {
+            return result_value(false);
+        }
+    }
+
+    struct DispatchTable {
+        BinaryKernel kernels[operator_count][type_count][type_count];
+    };
+
+    template<OperatorCode Op>
+    constexpr void add_errors(DispatchTable& table) {
+        for (auto& row: table.kernels[Op]) {
+            for (auto& kernel: row) kernel = unsupported<Op>;
+        }
+    }
+
+    template<OperatorCode Op, typename F>
+    constexpr void add_numeric(DispatchTable& table) {
+        table.kernels[Op][typeInt][typeInt] = scalar_kernel<F, 'i', 'i'>;
+        table.kernels[Op][typeInt][typeReal] = scalar_kernel<F, 'i', 'r'>;
+        table.kernels[Op][typeReal][typeInt] = scalar_kernel<F, 'r', 'i'>;
+        table.kernels[Op][typeReal][typeReal] = scalar_kernel<F, 'r', 'r'>;
+    }
+
+    template<OperatorCode Op, typename F>
+    constexpr void add_comparison(DispatchTable& table) {
+        add_numeric<Op, F>(table);
+        table.kernels[Op][typeString][typeString] = scalar_kernel<F, 's', 's'>;
+    }
+
+    constexpr DispatchTable make_dispatch_table() {
+        DispatchTable table{};
 
-    AmbiguousVariable* op_unary_plus(AmbiguousVariable* a) {
-		if (a->type == 'e') throw std::runtime_error("unary + operation cannot be performed on empty"); 
+        [&table]<size_t... Op>(std::index_sequence<Op...>) {
+            (add_errors<(OperatorCode) Op>(table), ...);
+        }(std::make_index_sequence<operator_count>());
+
+        add_numeric<binAdd, std::plus<>>(table);
+        table.kernels[binAdd][typeString][typeString] = string_addition;
+        table.kernels[binAdd][typeTuple][typeTuple] = tuple_addition;
+        table.kernels[binAdd][typeArray][typeArray] = array_addition;
+
+        add_numeric<binSubtract, std::minus<>>(table);
+        add_numeric<binMultiply, std::multiplies<>>(table);
+        add_numeric<binDivide, std::divides<>>(table);
+
+        add_comparison<binLess, std::less<>>(table);
+        add_comparison<binLessEqual, std::less_equal<>>(table);
+        add_comparison<binGreater, std::greater<>>(table);
+        add_comparison<binGreaterEqual, std::greater_equal<>>(table);
+
+        add_comparison<binEqual, std::equal_to<>>(table);
+        table.kernels[binEqual][typeBool][typeBool] = scalar_kernel<std::equal_to<>, 'b', 'b'>;
+        table.kernels[binEqual][typeArray][typeArray] = array_equality<true>;
+        table.kernels[binEqual][typeTuple][typeTuple] = tuple_equality<true>;
+
+        add_comparison<binNotEqual, std::not_equal_to<>>(table);
+        table.kernels[binNotEqual][typeBool][typeBool] = scalar_kernel<std::not_equal_to<>, 'b', 'b'>;
+        table.kernels[binNotEqual][typeArray][typeArray] = array_equality<false>;
+        table.kernels[binNotEqual][typeTuple][typeTuple] = tuple_equality<false>;
+
+        table.kernels[binXor][typeBool][typeBool] = scalar_kernel<logical_xor, 'b', 'b'>;
+        table.kernels[binAnd][typeBool][typeBool] = scalar_kernel<std::logical_and<>, 'b', 'b'>;
+        table.kernels[binOr][typeBool][typeBool] = scalar_kernel<std::logical_or<>, 'b', 'b'>;
+
+        return table;
+    }
+
+    constexpr DispatchTable dispatch_table = make_dispatch_table();
+
+    Value op_unary_plus(const Value& a) {
+		if (a.type == 'e') throw std::runtime_error("unary + operation cannot be performed on empty");
         return copy(a);
     }
 
-    AmbiguousVariable* op_unary_minus(AmbiguousVariable* a) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        switch (a->type) {
+    Value op_unary_minus(const Value& a) {
+        Value c;
+        switch (a.type) {
             case 'r':
-                c->type = 'r';
-                c->real_val = -c->real_val;
+                c.type = 'r';
+                c.real_val = -a.real_val;
                 return c;
             case 'i':
-                c->type = 'i';
-                c->int_val = -a->int_val;
+                c.type = 'i';
+                c.int_val = -a.int_val;
                 return c;
             default:
                 throw std::runtime_error("unary - operation can be performed only with integer or real");
         }
     }
 
-    AmbiguousVariable* op_unary_not(AmbiguousVariable* a) {
-        AmbiguousVariable* c = new AmbiguousVariable();
-        if (a->type != 'b') {
+    Value op_unary_not(const Value& a) {
+        Value c;
+        if (a.type != 'b') {
             throw std::runtime_error("not operation can be performed only with boolean");
         }
-        c->type = 'b';
-        c->bool_val = not a->bool_val;
+        c.type = 'b';
+        c.bool_val = not a.bool_val;
         return c;
     }
 
-    AmbiguousVariable* perform_unary_op(char op, AmbiguousVariable* variable) {
+    Value perform_unary_op(char op, const Value& variable) {
         switch (op) {
             case '+':
                 return op_unary_plus(variable);
@@ -954,111 +1497,395 @@ namespace arithmetic {
         return precedence(op1) < precedence(op2);
     }
 
-    AmbiguousVariable* apply_operator(AmbiguousVariable* a, AmbiguousVariable* b, const char& op) {
-        if (op == '+') return op_addition(a, b);
-        if (op == '-') return op_subtraction(a, b);
-        if (op == '*') return op_multiplication(a, b);
-        if (op == '/') return op_division(a, b);
-        if (op == '<') return op_lt(a, b);
-        if (op == 'l') return op_lte(a, b);
-        if (op == '>') return op_gt(a, b);
-        if (op == 'm') return op_gte(a, b);
-        if (op == '=') return op_eq(a, b);
-        if (op == 'n') return op_ne(a, b);
-        if (op == 'x') return op_xor(a, b);
-        if (op == 'a') return op_and(a, b);
-        if (op == 'o') return op_or(a, b);
-        throw std::runtime_error("Unknown operator");
-    }
-
-    AmbiguousVariable* evaluate_expression(const std::vector<AmbiguousVariable*>& unprepped_variables,
-                                           const std::vector<char>& unprepped_operators) {
-        std::vector < AmbiguousVariable*  > variables;
+    Value apply_operator(const Value& a, const Value& b, const char& op) {
+        return dispatch_table.kernels[operator_codes[(unsigned char) op]]
+                                     [type_codes[(unsigned char) a.type]]
+                                     [type_codes[(unsigned char) b.type]](a, b);
+    }
+
+    // Converts operator sequence of an expression into reverse polish notation, relation chains like
+    // a < b < c get an implicit `and` between relations.
+    // Non-negative entries refer to terms, negative entries are -1 - operator
+    void expression_order(const std::vector<char>& unprepped_operators, std::vector<int>& rpn) {
         std::vector<char> operators;
+        std::vector<int> variables;
 
-        operators.reserve(unprepped_operators.size());
-        variables.reserve(unprepped_variables.size());
+        rpn.clear();
 
         if (unprepped_operators.size() == 0) {
-            return unprepped_variables[0];
+            rpn.push_back(0);
+            return;
         }
 
         operators.push_back(unprepped_operators[0]);
-        variables.push_back(unprepped_variables[0]);
+        variables.push_back(0);
 
         for (int i = 1; i < unprepped_operators.size(); ++i) {
             if (precedence(unprepped_operators[i]) == 2 &&
                 precedence(unprepped_operators[i]) == precedence(unprepped_operators[i - 1])) {
                 operators.push_back('a');
-                variables.push_back(unprepped_variables[i]);
+                variables.push_back(i);
             }
             operators.push_back(unprepped_operators[i]);
-            variables.push_back(unprepped_variables[i]);
+            variables.push_back(i);
         }
-        variables.push_back(unprepped_variables.back());
+        variables.push_back(unprepped_operators.size());
 
-        std::stack < AmbiguousVariable*  > values;
         std::stack<char> ops;
-        if (!variables.empty()) {
-            values.push(variables[0]);
-        }
+        rpn.push_back(variables[0]);
 
         for (size_t i = 0; i < operators.size(); ++i) {
             const char& op = operators[i];
             while (!ops.empty() && has_higher_precedence(op, ops.top())) {
-                AmbiguousVariable* b = values.top();
-                values.pop();
-                AmbiguousVariable* a = values.top();
-                values.pop();
-                char operator_to_apply = ops.top();
+                rpn.push_back(-1 - ops.top());
                 ops.pop();
-                AmbiguousVariable* result = apply_operator(a, b, operator_to_apply);
-                values.push(result);
             }
             ops.push(op);
             if (i + 1 < variables.size()) {
-                values.push(variables[i + 1]);
+                rpn.push_back(variables[i + 1]);
             }
         }
         while (!ops.empty()) {
-            AmbiguousVariable* b = values.top();
-            values.pop();
-            AmbiguousVariable* a = values.top();
-            values.pop();
-            char operator_to_apply = ops.top();
+            rpn.push_back(-1 - ops.top());
             ops.pop();
-            AmbiguousVariable* result = apply_operator(a, b, operator_to_apply);
-            values.push(result);
         }
-        return values.top();
     }
 
-    AmbiguousVariable* get_by_index(AmbiguousVariable& a, long long index) {
-        if (a.type != 'a') {
-            throw std::runtime_error("Incorrect type of variable for getting value by index");
+    // For every position of rpn where the right operand of an `and` or `or` starts, the position of that
+    // operator, -1 elsewhere. Evaluation jumps past the operator once the left operand decides the result
+    void short_circuit_jumps(const std::vector<int>& rpn, std::vector<int>& jumps) {
+        // -> start of the subexpression ending at each position
+        std::vector<int> start(rpn.size());
+        jumps.assign(rpn.size(), -1);
+
+        for (int i = 0; i < rpn.size(); ++i) {
+            if (rpn[i] >= 0) {
+                start[i] = i;
+                continue;
+            }
+
+            int right = start[i - 1];
+            start[i] = start[right - 1];
+            if (rpn[i] == -1 - 'a' || rpn[i] == -1 - 'o') {
+                jumps[right] = i;
+            }
+        }
+    }
+
+    // Left operand of `and` / `or` that makes evaluating the right one unnecessary
+    bool decides(const Value& left, int op) {
+        return left.type == 'b' && left.bool_val == (op == -1 - 'o');
+    }
+
+    // Operand stack of evaluate_postfix, evaluations nested inside terms continue above postfix_top
+    std::vector<Value> postfix_stack;
+    size_t postfix_top = 0;
+
+    // Evaluates an expression given in the order of expression_order, term(i) points to the value of i-th term
+    template<typename Term>
+    Value evaluate_postfix(const std::vector<int>& rpn, const std::vector<int>& jumps, Term term) {
+        // -> a single operator without short-circuit needs no stack
+        if (rpn.size() == 3 && jumps[1] < 0) {
+            const Value* a = term(rpn[0]);
+            return apply_operator(*a, *term(rpn[1]), (char) (-1 - rpn[2]));
         }
-        long long real_index;
+
+        size_t base = postfix_top;
         try {
-            real_index = a.array_identifiers.at(index);
+            for (int k = 0; k < rpn.size(); ++k) {
+                if (jumps[k] >= 0 && decides(postfix_stack[postfix_top - 1], rpn[jumps[k]])) {
+                    k = jumps[k];
+                    continue;
+                }
+
+                if (rpn[k] >= 0) {
+                    Value value = *term(rpn[k]);
+                    if (postfix_top == postfix_stack.size()) postfix_stack.resize(2 * postfix_top + 8);
+                    postfix_stack[postfix_top++] = value;
+                } else {
+                    Value b = postfix_stack[--postfix_top];
+                    Value& a = postfix_stack[postfix_top - 1];
+                    a = apply_operator(a, b, (char) (-1 - rpn[k]));
+                }
+            }
+        } catch (...) {
+            postfix_top = base;
+            throw;
+        }
+
+        postfix_top = base;
+        return postfix_stack[base];
+    }
+
+    Value evaluate_expression(const std::vector<const Value*>& variables, const std::vector<char>& operators) {
+        std::vector<int> rpn;
+        std::vector<int> jumps;
+        expression_order(operators, rpn);
+        short_circuit_jumps(rpn, jumps);
+        return evaluate_postfix(rpn, jumps, [&variables](int i) { return variables[i]; });
+    }
+
+    Value* get_by_index(const Value& a, long long index) {
+        if (a.type != 'a') {
+            throw std::runtime_error("Incorrect type of variable for getting value by index");
         }
-        catch (...) {
+        Value* element = a.array_val->find(index);
+        if (element == nullptr) {
             throw std::runtime_error("Incorrect index");
         }
-        return a.array_values[real_index];
+        return element;
     }
 
-    AmbiguousVariable* get_by_key(AmbiguousVariable& m, const std::string& key) {
+    Value* get_by_key(const Value& m, const std::string& key) {
         if (m.type != 't') {
             throw std::runtime_error("Incorrect type of variable for getting value by key");
         }
-        long long real_index;
-        try {
-            real_index = m.tuple_identifiers.at(key);
-        }
-        catch (...) {
+        long long real_index = find_field(m.tuple_val->shape, key);
+        if (real_index < 0) {
             throw std::runtime_error("Incorrect key");
         }
-        return m.array_values[real_index];
+        return m.tuple_val->array_values[real_index];
+    }
+
+    const Array& array_argument(const Value& value) {
+        if (value.type != 'a') {
+            throw std::runtime_error(std::format("Expected array, got {}", get_name(value.type)));
+        }
+        return *value.array_val;
+    }
+
+    // Packed arrays with every element of 1..length present, their words can be processed in plain loops
+    bool is_complete(const Array& array) {
+        if (array.packing == 0 || array.packing == 'b') return false;
+        long long count = 0;
+        for (auto i: array.present) count += std::popcount(i);
+        return count == array.length;
+    }
+
+    Value builtin_length(const Value& value) {
+        Value result;
+        result.type = 'i';
+        switch (value.type) {
+            case 'a':
+                result.int_val = array_length(value.array_val);
+                break;
+            case 's':
+                result.int_val = (long long) string_length(value.string_val);
+                break;
+            case 't':
+                result.int_val = (long long) value.tuple_val->array_values.size();
+                break;
+            default:
+                throw std::runtime_error(std::format("Expected array, string or tuple, got {}", get_name(value.type)));
+        }
+        return result;
+    }
+
+    // -> ints are added up separately, the result is a real as soon as one of the elements is
+    Value builtin_sum(const Value& value) {
+        const Array& array = array_argument(value);
+        unsigned long long int_sum = 0;
+        double real_sum = 0;
+        bool real = false;
+
+        if (array.packing == 'i' && is_complete(array)) {
+            for (long long i = 0; i < array.length; ++i) int_sum += array.words[i];
+        } else if (array.packing == 'r' && is_complete(array)) {
+            for (long long i = 0; i < array.length; ++i) real_sum += std::bit_cast<double>(array.words[i]);
+            real = true;
+        } else {
+            for_each_value(array, [&](long long, const Value& element) {
+                if (element.type == 'i') {
+                    int_sum += (unsigned long long) element.int_val;
+                } else if (element.type == 'r') {
+                    real_sum += element.real_val;
+                    real = true;
+                } else {
+                    throw std::runtime_error("Expected array of numbers");
+                }
+            });
+        }
+
+        return real ? result_value((double) (long long) int_sum + real_sum) : result_value((long long) int_sum);
+    }
+
+    // Smallest (Max = false) or largest element by <, empty for arrays with no elements
+    template<bool Max>
+    Value builtin_extreme(const Value& value) {
+        const Array& array = array_argument(value);
+        Value best;
+
+        if (array.length > 0 && array.packing == 'i' && is_complete(array)) {
+            long long found = (long long) array.words[0];
+            for (long long i = 1; i < array.length; ++i) {
+                long long element = (long long) array.words[i];
+                found = Max ? std::max(found, element) : std::min(found, element);
+            }
+            return result_value(found);
+        }
+        if (array.length > 0 && array.packing == 'r' && is_complete(array)) {
+            // -> same comparisons as the generic loop, so nan elements are kept only when they come first
+            double found = std::bit_cast<double>(array.words[0]);
+            for (long long i = 1; i < array.length; ++i) {
+                double element = std::bit_cast<double>(array.words[i]);
+                found = (Max ? found < element : element < found) ? element : found;
+            }
+            return result_value(found);
+        }
+
+        bool first = true;
+        for_each_value(array, [&](long long, const Value& element) {
+            if (first || (Max ? apply_operator(best, element, '<') : apply_operator(element, best, '<')).bool_val) {
+                best = element;
+                first = false;
+            }
+        });
+        return copy(best);
+    }
+
+    // Smallest index holding an element equal to needle, empty if there is none. Elements that can not
+    // be compared with needle are not equal to it
+    Value builtin_find(const Value& value, const Value& needle) {
+        const Array& array = array_argument(value);
+        Value result;
+
+        if (array.packing != 0 && array.packing == needle.type && array.packing != 'b') {
+            for (long long i = 1; i <= array.length; ++i) {
+                bool equal = array.packing == 'i' ? (long long) array.words[i - 1] == needle.int_val :
+                             std::bit_cast<double>(array.words[i - 1]) == needle.real_val;
+                if (equal && test_bit(array.present, i)) return result_value(i);
+            }
+            return result;
+        }
+
+        for_each_value(array, [&](long long index, const Value& element) {
+            if (result.type == 'i' && result.int_val < index) return;
+            bool equal;
+            try {
+                equal = apply_operator(element, needle, '=').bool_val;
+            } catch (std::runtime_error& ex) {
+                equal = false;
+            }
+            if (equal) result = result_value(index);
+        });
+        return result;
+    }
+
+    // Array of copies of the elements, each moved from index i to length + 1 - i
+    Value builtin_reverse(const Value& value) {
+        const Array& array = array_argument(value);
+        Value result;
+        result.type = 'a';
+
+        if (array.packing != 0) {
+            Array reversed;
+            reversed.aliased = false;
+            reversed.packing = array.packing;
+            grow(&reversed, array.length);
+            for (long long i = 1; i <= array.length; ++i) {
+                if (!test_bit(array.present, i)) continue;
+                long long to = array.length + 1 - i;
+                if (array.packing == 'b') {
+                    set_bit(reversed.words, to, test_bit(array.words, i));
+                } else {
+                    reversed.words[to - 1] = array.words[i - 1];
+                }
+                set_bit(reversed.present, to, true);
+            }
+            // -> holes at the start of array end up after the last element
+            while (reversed.length > 0 && !test_bit(reversed.present, reversed.length)) --reversed.length;
+            reversed.present.resize((reversed.length + 63) / 64);
+            reversed.words.resize(reversed.packing == 'b' ? reversed.present.size() : reversed.length);
+            result.array_val = new_array(std::move(reversed));
+            return result;
+        }
+
+        // -> inserted in increasing order of the new indices so that they land in dense
+        std::vector <std::pair<long long, Value*>> elements;
+        array.for_each([&](long long index, Value* cell) {
+            elements.push_back({array.length + 1 - index, cell});
+        });
+        std::sort(elements.begin(), elements.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        Array reversed;
+        reversed.aliased = false;
+        reversed.dense.reserve(elements.size());
+        for (auto& [index, cell]: elements) {
+            reversed.insert(index, new_cell(copy(*cell)));
+        }
+        result.array_val = new_array(std::move(reversed));
+        return result;
+    }
+
+    // Order of numbers by <, with nan after everything else so that sorting stays well defined
+    bool number_before(const Value& a, const Value& b) {
+        if (a.type == 'i' && b.type == 'i') return a.int_val < b.int_val;
+        double left = a.type == 'i' ? (double) a.int_val : a.real_val;
+        double right = b.type == 'i' ? (double) b.int_val : b.real_val;
+        return left < right || (std::isnan(right) && !std::isnan(left));
+    }
+
+    // Array of copies of the elements in increasing order at indices 1 .. count, all of them have to be
+    // numbers or all of them strings
+    Value builtin_sort(const Value& value) {
+        const Array& array = array_argument(value);
+        Value result;
+        result.type = 'a';
+
+        if (array.packing == 'i' || array.packing == 'r') {
+            Array sorted;
+            sorted.aliased = false;
+            sorted.packing = array.packing;
+            for (long long i = 1; i <= array.length; ++i) {
+                if (test_bit(array.present, i)) sorted.words.push_back(array.words[i - 1]);
+            }
+            if (array.packing == 'i') {
+                std::sort(sorted.words.begin(), sorted.words.end(), [](unsigned long long a, unsigned long long b) {
+                    return (long long) a < (long long) b;
+                });
+            } else {
+                std::sort(sorted.words.begin(), sorted.words.end(), [](unsigned long long a, unsigned long long b) {
+                    double left = std::bit_cast<double>(a);
+                    double right = std::bit_cast<double>(b);
+                    return left < right || (std::isnan(right) && !std::isnan(left));
+                });
+            }
+            sorted.length = (long long) sorted.words.size();
+            sorted.present.assign((sorted.length + 63) / 64, ~0ull);
+            if (sorted.length % 64 != 0) sorted.present.back() = (1ull << (sorted.length % 64)) - 1;
+            result.array_val = new_array(std::move(sorted));
+            return result;
+        }
+
+        std::vector <Value> elements;
+        bool numbers = true;
+        bool strings = true;
+        for_each_value(array, [&](long long, const Value& element) {
+            elements.push_back(element);
+            numbers = numbers && (element.type == 'i' || element.type == 'r');
+            strings = strings && element.type == 's';
+        });
+
+        if (numbers) {
+            std::sort(elements.begin(), elements.end(), number_before);
+        } else if (strings) {
+            std::sort(elements.begin(), elements.end(), [](const Value& a, const Value& b) {
+                return text(a.string_val) < text(b.string_val);
+            });
+        } else {
+            throw std::runtime_error("Expected array of numbers or of strings");
+        }
+
+        Array sorted;
+        sorted.aliased = false;
+        sorted.dense.reserve(elements.size());
+        for (auto& i: elements) {
+            sorted.dense.push_back(new_cell(copy(i)));
+        }
+        sorted.length = (long long) sorted.dense.size();
+        result.array_val = new_array(std::move(sorted));
+        return result;
     }
 }
 
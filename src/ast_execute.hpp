@@ -2,16 +2,18 @@
 #define __TREE_EXECUTE_INCLUDED__
 
 #include <string>
+#include <chrono>
 #include <unordered_map>
 #include <iostream>
 #include <vector>
 
 #include "ast_nodes.hpp"
 #include "arithmetic.hpp"
+#include "ast_resolve.hpp"
 
 namespace ast_nodes {
 
-    arithmetic::AmbiguousVariable constempty;
+    arithmetic::Value constempty;
 
     enum ControlState {
         Normal,
@@ -21,65 +23,554 @@ namespace ast_nodes {
     };
 
     int control_flag = ControlState::Normal;
-    arithmetic::AmbiguousVariable* return_register;
+    arithmetic::Value* return_register;
+
+    // Call in tail position waiting for the returning function to give up its activation
+    struct tailcall {
+        arithmetic::Function* function = nullptr;
+        Node* node;
+        std::vector<arithmetic::Value*> args;
+    };
+
+    tailcall pending_call;
+
+    // Result of a node: either a reference to a variable cell or a temporary value
+    struct Operand {
+        arithmetic::Value* ref = nullptr;
+        arithmetic::Value temp;
+
+        arithmetic::Value& get() {
+            return ref != nullptr ? *ref : temp;
+        }
+
+        void set_value(const arithmetic::Value& value) {
+            ref = nullptr;
+            temp = value;
+        }
+
+        void set_cell(arithmetic::Value* cell) {
+            ref = cell;
+        }
+
+        // Temporaries are moved into a cell of their own when something keeps a reference to them
+        arithmetic::Value* cell() {
+            if (ref == nullptr) ref = arithmetic::new_cell(temp);
+            return ref;
+        }
+    };
+
+    // Temporaries returned by a function are handed over as they are, values that may still be referenced
+    // through variables or container elements are deep-copied
+    arithmetic::Value returned_value(const arithmetic::Value& result, bool temporary) {
+        if (temporary && result.type != 'a' && result.type != 't') return result;
+        return arithmetic::copy(result);
+    }
+
+    // Runs the native operation of foo on the values arg(j) gives for its parameters, false if the body has to run
+    template<typename F>
+    bool run_native(FunctionNode* foo, F arg, arithmetic::Value& result) {
+        const std::vector<int>& params = foo->native_params;
+        switch (foo->native) {
+            case Native::Slice:
+                return arithmetic::array_slice(arg(params[0]), arg(params[1]), arg(params[2]), result);
+            case Native::Length:
+                result = arithmetic::builtin_length(arg(params[0]));
+                return true;
+            case Native::Sum:
+                result = arithmetic::builtin_sum(arg(params[0]));
+                return true;
+            case Native::Min:
+                result = arithmetic::builtin_extreme<false>(arg(params[0]));
+                return true;
+            case Native::Max:
+                result = arithmetic::builtin_extreme<true>(arg(params[0]));
+                return true;
+            case Native::Find:
+                result = arithmetic::builtin_find(arg(params[0]), arg(params[1]));
+                return true;
+            case Native::Reverse:
+                result = arithmetic::builtin_reverse(arg(params[0]));
+                return true;
+            case Native::Sort:
+                result = arithmetic::builtin_sort(arg(params[0]));
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // run_native for a call at line, pos, where wrong arguments of builtins are reported
+    template<typename F>
+    bool call_native(FunctionNode* foo, F arg, arithmetic::Value& result, int line, int pos) {
+        try {
+            return run_native(foo, arg, result);
+        } catch (std::runtime_error& ex) {
+            throw std::invalid_argument(
+                    std::format("Evaluation error at line {}, pos {}:\n\t{}", line, pos, ex.what()));
+        }
+    }
+
+    // Temporaries can be moved into the target, values of other variables are duplicated
+    void assign(arithmetic::Value* target, Operand& source) {
+        if (source.ref == nullptr) {
+            *target = source.temp;
+        } else {
+            arithmetic::assign(target, *source.ref);
+        }
+    }
+
+    // Applies an assignment of the given type (:=, += or -=) to target
+    void update(arithmetic::Value* target, char type, Operand& source) {
+        switch (type) {
+            case '=':
+                assign(target, source);
+                break;
+            case '+':
+                arithmetic::op_plus_equality(target, source.get());
+                break;
+            case '-':
+                arithmetic::op_minus_equality(target, source.get());
+                break;
+        }
+    }
+
+    // Completes a store that store_target left without a cell, values fitting the packing of array stay unboxed
+    void store_element(arithmetic::Array* array, long long index, char type, Operand& source) {
+        if (!arithmetic::takes_unboxed(*array)) {
+            update(arithmetic::array_element(array, index), type, source);
+            return;
+        }
+
+        arithmetic::Value element;
+        arithmetic::element_value(*array, index, element);
+        if (type == '=') {
+            element = source.get();
+        } else if (type == '+') {
+            arithmetic::op_plus_equality(&element, source.get());
+        } else {
+            arithmetic::op_minus_equality(&element, source.get());
+        }
+        if (arithmetic::packed_store(array, index, element)) return;
+
+        arithmetic::Value* cell = arithmetic::array_element(array, index);
+        if (type == '=') {
+            assign(cell, source);
+        } else {
+            *cell = element;
+        }
+    }
+
+    // Gets aggregate cur ready for what the user of the primary does with the value reached through it
+    void prepare(arithmetic::Value& cur, Access access) {
+        switch (access) {
+            case Access::Read:
+                break;
+            case Access::Bind:
+            case Access::Assign:
+                arithmetic::expose(cur);
+                break;
+            default:
+                arithmetic::make_private(cur);
+        }
+    }
+
+    // Terms of concatenations share their element cells with the result, packed temporaries have none
+    void expose_term(Operand& term) {
+        arithmetic::Value& value = term.get();
+        if (term.ref == nullptr && value.type == 'a' && value.array_val->packing != 0) return;
+        arithmetic::expose(value);
+    }
+
+    // Slot of the field named by tail in tuple, -1 if it has none; the tail remembers the last shape it saw
+    long long field_slot(TailNode* tail, const arithmetic::Tuple* tuple) {
+        if (tail->shape != tuple->shape) {
+            long long slot = arithmetic::find_field(tuple->shape, tail->identifier);
+            if (slot < 0) return slot;
+            tail->shape = tuple->shape;
+            tail->slot = slot;
+        }
+        return tail->slot;
+    }
 
     struct scopeinfo {
         int node_id;
-        std::unordered_map<std::string, arithmetic::AmbiguousVariable*> variables;
-        std::unordered_map<int, arithmetic::AmbiguousVariable*> intermediates;
+        std::vector<arithmetic::Value*, pool::allocator<arithmetic::Value*>> variables;
+        scopeinfo* parent = nullptr;
+        unsigned int mark = 0;
+
+        static void* operator new(size_t size) {
+            return pool::allocate(size);
+        }
+
+        static void operator delete(void* memory, size_t size) {
+            pool::deallocate(memory, size);
+        }
     };
 
     std::ostream& operator<<(std::ostream& out, scopeinfo& var) {
         out << "Scope " << var.node_id << std::endl;
         out << "Variables:" << std::endl;
-        for (auto i: var.variables) {
-            out << '\t' << i.first << ' ' << *i.second << std::endl;
-        }
-        out << "Intermediates:" << std::endl;
-        for (auto i: var.intermediates) {
-            if (i.second != nullptr) {
-                out << '\t' << i.first << ' ' << *i.second << std::endl;
-
+        for (int i = 0; i < var.variables.size(); ++i) {
+            if (var.variables[i] != nullptr) {
+                out << '\t' << i << ' ' << *var.variables[i] << std::endl;
             } else {
-                out << '\t' << i.first << ' ' << 0 << std::endl;
+                out << '\t' << i << ' ' << 0 << std::endl;
             }
         }
         out << "END OF SCOPE" << std::endl;
         return out;
     }
 
-    std::vector <scopeinfo> scopes;
+    scopeinfo* scope = nullptr;
+
+    // Result registers of the running function activation, indexed by Node::reg
+    Operand* registers = nullptr;
+
+    struct frameinfo {
+        Operand* registers;
+        int register_count;
+        scopeinfo* caller;
+        // Position in register_blocks to return to when the activation ends
+        size_t block;
+        size_t top;
+    };
+
+    // Register files of all running function activations
+    std::vector<frameinfo> frames;
+
+    // Register files are carved out of blocks that are kept for reuse, blocks never move once allocated
+    const size_t register_block_size = 1 << 14;
+    std::vector<std::vector<Operand>> register_blocks;
+    size_t register_block = 0;
+    size_t register_top = 0;
+
+    // Scopes that were closed, their variable vectors keep the capacity
+    std::vector<scopeinfo*> spare_scopes;
+
+    void push_frame(int register_count, scopeinfo* caller) {
+        size_t block = register_block;
+        size_t top = register_top;
+
+        if (register_blocks.empty() || register_top + register_count > register_blocks[register_block].size()) {
+            if (!register_blocks.empty()) ++register_block;
+            while (register_block < register_blocks.size() &&
+                   register_blocks[register_block].size() < register_count) {
+                ++register_block;
+            }
+            if (register_block == register_blocks.size()) {
+                register_blocks.emplace_back(std::max(register_block_size, (size_t) register_count));
+            }
+            register_top = 0;
+        }
+
+        registers = register_blocks[register_block].data() + register_top;
+        register_top += register_count;
+        std::fill(registers, registers + register_count, Operand());
+        frames.push_back({registers, register_count, caller, block, top});
+    }
+
+    void pop_frame() {
+        register_block = frames.back().block;
+        register_top = frames.back().top;
+        frames.pop_back();
+        registers = frames.empty() ? nullptr : frames.back().registers;
+    }
+
+    // Flat environments of functions, these are freed by the garbage collector
+    std::vector<scopeinfo*> captured_scopes;
 
-    void open_scope(ast_nodes::Node* parent) {
-        scopes.resize(scopes.size() + 1);
-        scopes.back().node_id = parent->id;
+    size_t size_of(const scopeinfo* captured) {
+        return sizeof(scopeinfo) + captured->variables.capacity() * sizeof(arithmetic::Value*);
+    }
+
+    void open_scope(ast_nodes::Node* parent, int slot_count, scopeinfo* enclosing) {
+        scopeinfo* opened;
+        if (spare_scopes.empty()) {
+            opened = new scopeinfo();
+        } else {
+            opened = spare_scopes.back();
+            spare_scopes.pop_back();
+        }
+        opened->node_id = parent->id;
+        opened->variables.assign(slot_count, nullptr);
+        opened->parent = enclosing;
+        opened->mark = 0;
+        scope = opened;
+    }
+
+    void open_scope(ast_nodes::Node* parent, int slot_count) {
+        open_scope(parent, slot_count, scope);
+    }
+
+    // Functions keep their own copies of the variables they use, so scopes die with the code that opened them
+    void release_scope(scopeinfo* closing) {
+        closing->variables.clear();
+        spare_scopes.push_back(closing);
+    }
+
+    void close_scope() {
+        scopeinfo* closing = scope;
+        scope = scope->parent;
+        release_scope(closing);
     }
 
     void close_scope(ast_nodes::Node* parent) {
-        if (scopes.size() == 0) {
+        if (scope == nullptr || scope->node_id != parent->id) {
             throw std::invalid_argument("SCOPE DOES NOT EXIST WHILE CLOSING");
         }
-        while (scopes.back().node_id != parent->id) {
-            scopes.resize(scopes.size() - 1);
-            if (scopes.size() == 0) {
-                throw std::invalid_argument("SCOPE DOES NOT EXIST WHILE CLOSING");
+        close_scope();
+    }
+
+    // Scope around the program with a variable for each builtin, neither it nor its cells are ever collected
+    scopeinfo* builtin_scope() {
+        scopeinfo* opened = new scopeinfo();
+        opened->node_id = 0;
+        for (auto foo: builtin_functions()) {
+            arithmetic::Value value;
+            value.type = 'f';
+            value.function_val = arithmetic::new_builtin_function(foo);
+            opened->variables.push_back(arithmetic::new_constant(value));
+        }
+        return opened;
+    }
+
+    // Collects the variables a function refers to into a flat scope that becomes the parent of its calls
+    scopeinfo* capture_scope(ast_nodes::FunctionNode* foo) {
+        if (foo->captures.empty()) return nullptr;
+
+        scopeinfo* captured = new scopeinfo();
+        captured->node_id = foo->id;
+        captured->variables.reserve(foo->captures.size());
+        for (auto [depth, slot]: foo->captures) {
+            scopeinfo* owner = scope;
+            for (int i = depth; i > 0; --i) {
+                owner = owner->parent;
             }
+            captured->variables.push_back(owner->variables[slot]);
         }
-        scopes.resize(scopes.size() - 1);
+
+        captured_scopes.push_back(captured);
+        arithmetic::heap.bytes += size_of(captured);
+        return captured;
     }
 
-    arithmetic::AmbiguousVariable* get_variable(std::string identifier) {
-        for (int i = (signed) (scopes.size()) - 1; i >= 0; --i) {
-            if (scopes[i].variables.count(identifier)) {
-                return scopes[i].variables[identifier];
+    void mark(Operand& operand) {
+        if (operand.ref != nullptr) {
+            arithmetic::mark_cell(operand.ref);
+        } else {
+            arithmetic::mark(operand.temp);
+        }
+    }
+
+    void mark(scopeinfo* root) {
+        arithmetic::heap.scope_work.push_back(root);
+    }
+
+    void mark_scopes() {
+        arithmetic::Heap& heap = arithmetic::heap;
+        while (!heap.scope_work.empty()) {
+            scopeinfo* i = heap.scope_work.back();
+            heap.scope_work.pop_back();
+
+            for (; i != nullptr && i->mark != heap.epoch; i = i->parent) {
+                i->mark = heap.epoch;
+                for (auto variable: i->variables) {
+                    if (variable != nullptr) arithmetic::mark_cell(variable);
+                }
             }
         }
-        throw std::invalid_argument(std::format("Variable {} referenced before declaration", identifier));
+    }
+
+    std::chrono::steady_clock::time_point collection_start;
+
+    void begin_collection() {
+        collection_start = std::chrono::steady_clock::now();
+        ++arithmetic::heap.epoch;
+    }
+
+    // Marks everything reachable from the running code and the roots queued after begin_collection,
+    // then frees the rest
+    void finish_collection() {
+        arithmetic::Heap& heap = arithmetic::heap;
+
+        mark(scope);
+        if (return_register != nullptr) arithmetic::mark(*return_register);
+        for (auto& i: frames) {
+            for (int j = 0; j < i.register_count; ++j) {
+                mark(i.registers[j]);
+            }
+            mark(i.caller);
+        }
+        for (size_t i = 0; i < arithmetic::postfix_top; ++i) {
+            arithmetic::mark(arithmetic::postfix_stack[i]);
+        }
+
+        while (!heap.cell_work.empty() || !heap.scope_work.empty()) {
+            arithmetic::mark_cells();
+            mark_scopes();
+        }
+
+        size_t live = arithmetic::sweep();
+        size_t kept = 0;
+        for (auto i: captured_scopes) {
+            if (i->mark == heap.epoch) {
+                live += size_of(i);
+                captured_scopes[kept++] = i;
+            } else {
+                heap.reclaimed += size_of(i);
+                delete i;
+            }
+        }
+        captured_scopes.resize(kept);
+
+        heap.bytes = live;
+        heap.threshold = std::max(heap.min_threshold, 2 * live);
+
+        long long pause = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - collection_start).count();
+        ++heap.collections;
+        heap.pause_us += pause;
+        heap.max_pause_us = std::max(heap.max_pause_us, pause);
+    }
+
+    void collect_garbage() {
+        begin_collection();
+        finish_collection();
+    }
+
+    arithmetic::Value* get_variable(ast_nodes::PrimaryNode* node) {
+        if (node->slot >= 0) {
+            scopeinfo* owner = scope;
+            for (int i = node->depth; i > 0; --i) {
+                owner = owner->parent;
+            }
+            if (owner->variables[node->slot] != nullptr) {
+                return owner->variables[node->slot];
+            }
+        }
+        throw std::invalid_argument(std::format("Variable {} referenced before declaration", node->identifier));
+    }
+
+    // Variant for a single binary operator on the given operand types
+    Quick specialize_binary(char op, char left, char right) {
+        if (left == 'i' && right == 'i') {
+            switch (op) {
+                case '+': return Quick::IntAdd;
+                case '-': return Quick::IntSubtract;
+                case '*': return Quick::IntMultiply;
+                case '/': return Quick::IntDivide;
+                case '<': return Quick::IntLess;
+                case 'l': return Quick::IntLessEqual;
+                case '>': return Quick::IntGreater;
+                case 'm': return Quick::IntGreaterEqual;
+                case '=': return Quick::IntEqual;
+                case 'n': return Quick::IntNotEqual;
+            }
+        } else if (left == 'r' && right == 'r') {
+            switch (op) {
+                case '+': return Quick::RealAdd;
+                case '-': return Quick::RealSubtract;
+                case '*': return Quick::RealMultiply;
+                case '/': return Quick::RealDivide;
+                case '<': return Quick::RealLess;
+                case 'l': return Quick::RealLessEqual;
+                case '>': return Quick::RealGreater;
+                case 'm': return Quick::RealGreaterEqual;
+            }
+        }
+        return Quick::Generic;
+    }
+
+    // Computes a specialized binary operator, false when the operands are not of the types it expects
+    bool quick_binary(Quick quick, const arithmetic::Value& a, const arithmetic::Value& b,
+                      arithmetic::Value& result) {
+        if (a.type == 'i' && b.type == 'i') {
+            switch (quick) {
+                case Quick::IntAdd: result.type = 'i'; result.int_val = a.int_val + b.int_val; return true;
+                case Quick::IntSubtract: result.type = 'i'; result.int_val = a.int_val - b.int_val; return true;
+                case Quick::IntMultiply: result.type = 'i'; result.int_val = a.int_val * b.int_val; return true;
+                case Quick::IntDivide: result.type = 'i'; result.int_val = a.int_val / b.int_val; return true;
+                case Quick::IntLess: result.type = 'b'; result.bool_val = a.int_val < b.int_val; return true;
+                case Quick::IntLessEqual: result.type = 'b'; result.bool_val = a.int_val <= b.int_val; return true;
+                case Quick::IntGreater: result.type = 'b'; result.bool_val = a.int_val > b.int_val; return true;
+                case Quick::IntGreaterEqual: result.type = 'b'; result.bool_val = a.int_val >= b.int_val; return true;
+                case Quick::IntEqual: result.type = 'b'; result.bool_val = a.int_val == b.int_val; return true;
+                case Quick::IntNotEqual: result.type = 'b'; result.bool_val = a.int_val != b.int_val; return true;
+                default: return false;
+            }
+        }
+        if (a.type == 'r' && b.type == 'r') {
+            switch (quick) {
+                case Quick::RealAdd: result.type = 'r'; result.real_val = a.real_val + b.real_val; return true;
+                case Quick::RealSubtract: result.type = 'r'; result.real_val = a.real_val - b.real_val; return true;
+                case Quick::RealMultiply: result.type = 'r'; result.real_val = a.real_val * b.real_val; return true;
+                case Quick::RealDivide: result.type = 'r'; result.real_val = a.real_val / b.real_val; return true;
+                case Quick::RealLess: result.type = 'b'; result.bool_val = a.real_val < b.real_val; return true;
+                case Quick::RealLessEqual: result.type = 'b'; result.bool_val = a.real_val <= b.real_val; return true;
+                case Quick::RealGreater: result.type = 'b'; result.bool_val = a.real_val > b.real_val; return true;
+                case Quick::RealGreaterEqual: result.type = 'b'; result.bool_val = a.real_val >= b.real_val; return true;
+                default: return false;
+            }
+        }
+        return false;
+    }
+
+    Quick specialize_unary(char op, char type) {
+        if (op == '-' && type == 'i') return Quick::IntNegate;
+        if (op == '-' && type == 'r') return Quick::RealNegate;
+        if (op == 'n' && type == 'b') return Quick::BoolNot;
+        return Quick::Generic;
+    }
+
+    bool quick_unary(Quick quick, const arithmetic::Value& a, arithmetic::Value& result) {
+        switch (quick) {
+            case Quick::IntNegate:
+                if (a.type != 'i') return false;
+                result.type = 'i';
+                result.int_val = -a.int_val;
+                return true;
+            case Quick::RealNegate:
+                if (a.type != 'r') return false;
+                result.type = 'r';
+                result.real_val = -a.real_val;
+                return true;
+            case Quick::BoolNot:
+                if (a.type != 'b') return false;
+                result.type = 'b';
+                result.bool_val = !a.bool_val;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Variant for adding to ('+') or subtracting from ('-') a target in place
+    Quick specialize_update(char op, char target, char operand) {
+        if (target == 'i' && operand == 'i') return op == '+' ? Quick::IntAddTo : Quick::IntSubtractFrom;
+        if (target == 'r' && operand == 'r') return op == '+' ? Quick::RealAddTo : Quick::RealSubtractFrom;
+        return Quick::Generic;
+    }
+
+    bool quick_update(Quick quick, arithmetic::Value* target, const arithmetic::Value& operand) {
+        if (target->type == 'i' && operand.type == 'i') {
+            if (quick == Quick::IntAddTo) target->int_val += operand.int_val;
+            else if (quick == Quick::IntSubtractFrom) target->int_val -= operand.int_val;
+            else return false;
+            return true;
+        }
+        if (target->type == 'r' && operand.type == 'r') {
+            if (quick == Quick::RealAddTo) target->real_val += operand.real_val;
+            else if (quick == Quick::RealSubtractFrom) target->real_val -= operand.real_val;
+            else return false;
+            return true;
+        }
+        return false;
     }
 
     //Create new scope
     void BodyNode::execute(std::istream& in, std::ostream& out) {
-        open_scope(this);
+        if (arithmetic::collection_due()) collect_garbage();
+        open_scope(this, slot_count);
         for (auto i: statements) {
             i->execute(in, out);
             if (control_flag != ControlState::Normal) break;
@@ -89,30 +580,66 @@ namespace ast_nodes {
 
     //Adds variables to current scope
     void DeclarationNode::execute(std::istream& in, std::ostream& out) {
-        if (value != nullptr) {
+        if (value != nullptr && self_captured) {
+            // -> functions created by the initializer hold the cell before it gets its value
+            arithmetic::Value* cell = arithmetic::new_cell();
+            scope->variables[slot] = cell;
+            value->execute(in, out);
+            assign(cell, registers[value->reg]);
+        } else if (value != nullptr) {
             value->execute(in, out);
-            scopes.back().variables[identifier] = scopes.back().intermediates[value->id];
+            scope->variables[slot] = registers[value->reg].cell();
         } else {
-            scopes.back().variables[identifier] = new arithmetic::AmbiguousVariable();
+            scope->variables[slot] = arithmetic::new_cell();
         }
     }
 
     // Evaluate expression and put its value into current scope
     void ExpressionNode::execute(std::istream& in, std::ostream& out) {
-        std::vector<arithmetic::AmbiguousVariable*> calced_terms;
-        calced_terms.reserve(terms.size());
+        if (ops.empty()) {
+            terms[0]->execute(in, out);
+            registers[reg] = registers[terms[0]->reg];
+            return;
+        }
 
-        for (auto i: terms) {
-            i->execute(in, out);
-            calced_terms.push_back(scopes.back().intermediates[i->id]);
+        for (int i = 0; i < first_lazy; ++i) {
+            terms[i]->execute(in, out);
         }
 
+        if (quick != Quick::Generic) {
+            const arithmetic::Value& a = registers[terms[0]->reg].get();
+            const arithmetic::Value& b = registers[terms[1]->reg].get();
+            if (quick == Quick::Uninitialized) quick = specialize_binary(ops[0], a.type, b.type);
+
+            arithmetic::Value result;
+            if (quick_binary(quick, a, b, result)) {
+                registers[reg].set_value(result);
+                return;
+            }
+            quick = Quick::Generic;
+        }
+
+        // -> terms of relation chains appear twice in rpn but are evaluated once,
+        // errors of terms evaluated during the walk are already reported at their own position
+        int next_lazy = first_lazy;
+        bool in_term = false;
         try {
-            scopes.back().intermediates[id] = evaluate_expression(calced_terms, ops);
+            registers[reg].set_value(arithmetic::evaluate_postfix(rpn, jumps, [&](int i) {
+                if (i >= next_lazy) {
+                    in_term = true;
+                    terms[i]->execute(in, out);
+                    in_term = false;
+                    next_lazy = i + 1;
+                }
+                if (concatenates) expose_term(registers[terms[i]->reg]);
+                return &registers[terms[i]->reg].get();
+            }));
         } catch (std::invalid_argument& ex) {
+            if (in_term) throw;
             throw std::invalid_argument(
                     std::format("Evaluation error at line {}, pos {}:\n\t{}", line, pos, ex.what()));
         } catch (std::runtime_error& ex) {
+            if (in_term) throw;
             throw std::invalid_argument(
                     std::format("Evaluation error at line {}, pos {}:\n\t{}", line, pos, ex.what()));
         }
@@ -122,10 +649,21 @@ namespace ast_nodes {
     // Evaluate unary operator and put its value into current scope
     void UnaryNode::execute(std::istream& in, std::ostream& out) {
         primary->execute(in, out);
-        arithmetic::AmbiguousVariable* new_term;
+        Operand new_term = registers[primary->reg];
 
         try {
-            new_term = perform_unary_op(unaryop, scopes.back().intermediates[primary->id]);
+            if (unaryop != '#') {
+                const arithmetic::Value& value = new_term.get();
+                if (quick == Quick::Uninitialized) quick = specialize_unary(unaryop, value.type);
+
+                arithmetic::Value result;
+                if (quick != Quick::Generic && quick_unary(quick, value, result)) {
+                    new_term.set_value(result);
+                } else {
+                    quick = Quick::Generic;
+                    new_term.set_value(perform_unary_op(unaryop, value));
+                }
+            }
         } catch (std::invalid_argument& ex) {
             throw std::invalid_argument(
                     std::format("Evaluation error at line {}, pos {}:\n\t{}", line, pos, ex.what()));
@@ -135,12 +673,12 @@ namespace ast_nodes {
         }
 
         if (type_ind == '#') {
-            scopes.back().intermediates[id] = new_term;
+            registers[reg] = new_term;
         } else {
-            arithmetic::AmbiguousVariable* is_type = new arithmetic::AmbiguousVariable();
-            is_type->type = 'b';
-            is_type->bool_val = (type_ind == new_term->type);
-            scopes.back().intermediates[id] = is_type;
+            arithmetic::Value is_type;
+            is_type.type = 'b';
+            is_type.bool_val = (type_ind == new_term.get().type);
+            registers[reg].set_value(is_type);
         }
     }
 
@@ -148,59 +686,70 @@ namespace ast_nodes {
 
     void PrimaryNode::execute(std::istream& in, std::ostream& out) {
         if (type == 'i') {
-            arithmetic::AmbiguousVariable* inputted_value = new arithmetic::AmbiguousVariable();
-            inputted_value->type = 'i';
-            in >> inputted_value->int_val;
-            scopes.back().intermediates[id] = inputted_value;
+            arithmetic::Value inputted_value;
+            inputted_value.type = 'i';
+            in >> inputted_value.int_val;
+            registers[reg].set_value(inputted_value);
         } else if (type == 'r') {
-            arithmetic::AmbiguousVariable* inputted_value = new arithmetic::AmbiguousVariable();
-            inputted_value->type = 'r';
-            in >> inputted_value->real_val;
-            scopes.back().intermediates[id] = inputted_value;
+            arithmetic::Value inputted_value;
+            inputted_value.type = 'r';
+            in >> inputted_value.real_val;
+            registers[reg].set_value(inputted_value);
         } else if (type == 's') {
-            arithmetic::AmbiguousVariable* inputted_value = new arithmetic::AmbiguousVariable();
-            inputted_value->type = 's';
-            in >> inputted_value->string_val;
-            scopes.back().intermediates[id] = inputted_value;
+            arithmetic::Value inputted_value;
+            inputted_value.type = 's';
+            inputted_value.string_val = arithmetic::new_string("");
+            in >> inputted_value.string_val->value;
+            registers[reg].set_value(inputted_value);
         } else if (type == 'v') {
-            arithmetic::AmbiguousVariable* var = get_variable(identifier);
+            // -> chained values stay in the register so the garbage collector can see them during calls
+            Operand& var = registers[reg];
+            var.set_cell(get_variable(this));
             //var.type = 'f';
 
             for (ast_nodes::Node* i: tails) {
+                // -> the assignment evaluates the last subscript itself
+                if (stores_element && i == tails.back()) break;
+
                 i->execute(in, out);
                 ast_nodes::TailNode* tail = dynamic_cast<ast_nodes::TailNode*> (i);
+                arithmetic::Value& cur = var.get();
+                prepare(cur, access);
 
                 if (tail->type == 't') {
-                    if (var->type != 't') {
+                    if (cur.type != 't') {
                         throw std::invalid_argument(
                                 std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected tuple"));
                     }
 
-                    if (var->array_values.size() < tail->tuple_idx - 1) {
+                    if (tail->tuple_idx < 1 || tail->tuple_idx > (long long) cur.tuple_val->array_values.size()) {
                         throw std::invalid_argument(
                                 std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Tuple index out of range"));
                     }
 
-                    var = var->array_values[tail->tuple_idx - 1];
+                    var.set_cell(cur.tuple_val->array_values[tail->tuple_idx - 1]);
+                    if (access == Access::Read) arithmetic::share_element(cur, var.get());
                 } else if (tail->type == 'i') {
-                    if (var->type != 't') {
+                    if (cur.type != 't') {
                         throw std::invalid_argument(
                                 std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected tuple"));
                     }
 
-                    if (var->tuple_identifiers.count(tail->identifier) == 0) {
+                    long long slot = field_slot(tail, cur.tuple_val);
+                    if (slot < 0) {
                         throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
                                                                 "Tuple identifier not present"));
                     }
 
-                    var = var->array_values[var->tuple_identifiers[tail->identifier]];
+                    var.set_cell(cur.tuple_val->array_values[slot]);
+                    if (access == Access::Read) arithmetic::share_element(cur, var.get());
                 } else if (tail->type == 'p') {
-                    if (var->type != 'f') {
+                    if (cur.type != 'f') {
                         throw std::invalid_argument(
                                 std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected function"));
                     }
 
-                    ast_nodes::FunctionNode* foo = var->function_pointer;
+                    ast_nodes::FunctionNode* foo = cur.function_val->function_pointer;
 
                     if (foo->params.size() != tail->params.size()) {
                         throw std::invalid_argument(std::format(
@@ -208,69 +757,116 @@ namespace ast_nodes {
                                 pos, foo->params.size(), tail->params.size()));
                     }
 
-                    scopeinfo capture;
-                    capture.variables = var->function_scope;
-                    scopes.push_back(capture);
+                    arithmetic::Value native_result;
+                    if (foo->native != Native::None &&
+                        call_native(foo, [&](int j) -> arithmetic::Value& { return registers[tail->params[j]->reg].get(); },
+                                    native_result, line, pos)) {
+                        var.set_value(native_result);
+                        continue;
+                    }
+
+                    if (tail_call && i == tails.back()) {
+                        // -> performed by the caller of the running function once it has returned
+                        pending_call.function = cur.function_val;
+                        pending_call.node = i;
+                        for (auto param: tail->params) {
+                            pending_call.args.push_back(registers[param->reg].cell());
+                        }
+                        var.set_value(constempty);
+                        break;
+                    }
+
+                    scopeinfo* caller = scope;
+                    Operand* caller_registers = registers;
 
-                    open_scope(i);
+                    push_frame(foo->register_count, caller);
+                    open_scope(i, foo->params.size(), cur.function_val->function_scope);
 
                     for (int j = 0; j < foo->params.size(); ++j) {
-                        scopes.back().variables[foo->params[j]] = scopes[scopes.size() -
-                                                                         3].intermediates[tail->params[j]->id];
+                        scope->variables[j] = caller_registers[tail->params[j]->reg].cell();
                     }
 
-                    return_register = &constempty;
+                    while (true) {
+                        return_register = &constempty;
 
-                    foo->body->execute(in, out);
+                        foo->body->execute(in, out);
 
-                    if (control_flag == ControlState::Return) {
-                        control_flag = ControlState::Normal;
-                    }
+                        if (control_flag == ControlState::Return) {
+                            control_flag = ControlState::Normal;
+                        }
 
-                    if (control_flag != ControlState::Normal) {
-                        throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
-                                                                "Unexpected break or continue in function call"));
+                        if (control_flag != ControlState::Normal) {
+                            throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
+                                                                    "Unexpected break or continue in function call"));
+                        }
+
+                        if (pending_call.function == nullptr) break;
+
+                        // -> the activation of the function that returned is replaced by the one of the tail call
+                        foo = pending_call.function->function_pointer;
+                        release_scope(scope);
+                        pop_frame();
+                        push_frame(foo->register_count, caller);
+                        open_scope(pending_call.node, foo->params.size(), pending_call.function->function_scope);
+
+                        for (int j = 0; j < foo->params.size(); ++j) {
+                            scope->variables[j] = pending_call.args[j];
+                        }
+                        pending_call.function = nullptr;
+                        pending_call.args.clear();
                     }
 
                     if (foo->type == 'l') {
-                        return_register = scopes.back().intermediates[foo->body->id];
+                        return_register = &registers[foo->body->reg].get();
                     }
 
-                    var = arithmetic::copy(return_register);
+                    // -> the result is a temporary if it lives in one of the callee registers
+                    bool temporary = (char*) return_register >= (char*) registers &&
+                                     (char*) return_register < (char*) (registers + foo->register_count);
+                    var.set_value(returned_value(*return_register, temporary));
+                    return_register = &constempty;
 
-                    close_scope(i);
-                    scopes.resize(scopes.size() - 1);
+                    release_scope(scope);
+                    scope = caller;
+                    pop_frame();
                 } else if (tail->type == 's') {
-                    if (var->type != 'a') {
+                    if (cur.type != 'a') {
                         throw std::invalid_argument(
                                 std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected array"));
                     }
 
-                    arithmetic::AmbiguousVariable* sub = scopes.back().intermediates[tail->subscript->id];
-                    if (sub->type != 'i') {
+                    const arithmetic::Value& sub = registers[tail->subscript->reg].get();
+                    if (sub.type != 'i') {
                         throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
                                                                 "Expected integer as array index"));
                     }
 
-                    if (var->array_identifiers.count(sub->int_val) == 0) {
-                        var->array_identifiers[sub->int_val] = var->array_values.size();
-                        var->array_values.push_back(new arithmetic::AmbiguousVariable());
+                    // -> reads of missing elements give a temporary empty value, only assignments add them.
+                    // Packed elements are read as temporaries, arrays whose cells are bound are unpacked by now
+                    arithmetic::Value element;
+                    if (access == Access::Assign) {
+                        var.set_cell(arithmetic::array_element(cur.array_val, sub.int_val));
+                    } else if (cur.array_val->packing != 0) {
+                        var.set_value(arithmetic::packed_element(*cur.array_val, sub.int_val, element) ? element :
+                                      constempty);
+                    } else if (arithmetic::Value* found = cur.array_val->find(sub.int_val)) {
+                        var.set_cell(found);
+                        if (access == Access::Read) arithmetic::share_element(cur, *found);
+                    } else {
+                        var.set_value(constempty);
                     }
-
-                    var = var->array_values[var->array_identifiers[sub->int_val]];
                 } else {
                     throw std::invalid_argument(
                             std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected valid type"));
                 }
             }
-            scopes.back().intermediates[id] = var;
         } else if (type == 'l') {
 
             literal->execute(in, out);
-            scopes.back().intermediates[id] = scopes.back().intermediates[literal->id];
+            registers[reg] = registers[literal->reg];
         } else if (type == 'e') {
             expression->execute(in, out);
-            scopes.back().intermediates[id] = scopes.back().intermediates[expression->id];
+            registers[reg] = registers[expression->reg];
         } else {
             throw std::invalid_argument(
                     std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected valid type"));
@@ -279,22 +875,92 @@ namespace ast_nodes {
 
     // Assign value to variable in current scope
     void AssignmentNode::execute(std::istream& in, std::ostream& out) {
+        PrimaryNode* target_node = static_cast<PrimaryNode*>(primary);
         primary->execute(in, out);
 
         if (type == '#') return;
 
+        if (target_node->stores_element) {
+            TailNode* tail = static_cast<TailNode*>(target_node->tails.back());
+            tail->execute(in, out);
+
+            arithmetic::Value& holder = registers[primary->reg].get();
+            if (holder.type != 'a') {
+                throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", target_node->line,
+                                                        target_node->pos, "Expected array"));
+            }
+            const arithmetic::Value& sub = registers[tail->subscript->reg].get();
+            if (sub.type != 'i') {
+                throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", target_node->line,
+                                                        target_node->pos, "Expected integer as array index"));
+            }
+
+            arithmetic::make_private(holder);
+            long long index = sub.int_val;
+            arithmetic::store_target(holder.array_val, index);
+            expression->execute(in, out);
+
+            // -> a value read from the array itself shares it by now
+            arithmetic::Value& array = registers[primary->reg].get();
+            arithmetic::make_private(array);
+            store_element(array.array_val, index, type, registers[expression->reg]);
+            return;
+        }
+
+        if (self_append) {
+            // -> the left term is the target itself, only the added one needs evaluating
+            ExpressionNode* expr = static_cast<ExpressionNode*>(expression);
+            expr->terms[1]->execute(in, out);
+            arithmetic::Value* target = &registers[primary->reg].get();
+            arithmetic::Value& added = registers[expr->terms[1]->reg].get();
+
+            if (quick == Quick::Uninitialized) quick = specialize_update('+', target->type, added.type);
+            if (quick != Quick::Generic) {
+                if (quick_update(quick, target, added)) return;
+                quick = Quick::Generic;
+            }
+
+            if (target->type == 'a' && added.type == 'a') {
+                arithmetic::op_plus_equality(target, added);
+                return;
+            }
+
+            try {
+                arithmetic::expose(*target);
+                arithmetic::expose(added);
+                registers[expr->reg].set_value(arithmetic::apply_operator(*target, added, '+'));
+            } catch (std::invalid_argument& ex) {
+                throw std::invalid_argument(
+                        std::format("Evaluation error at line {}, pos {}:\n\t{}", expr->line, expr->pos, ex.what()));
+            } catch (std::runtime_error& ex) {
+                throw std::invalid_argument(
+                        std::format("Evaluation error at line {}, pos {}:\n\t{}", expr->line, expr->pos, ex.what()));
+            }
+            assign(target, registers[expr->reg]);
+            return;
+        }
+
         expression->execute(in, out);
+        arithmetic::Value* target = &registers[primary->reg].get();
+
+        if (type != '=' && quick != Quick::Generic) {
+            const arithmetic::Value& operand = registers[expression->reg].get();
+            if (quick == Quick::Uninitialized) quick = specialize_update(type, target->type, operand.type);
+            if (quick != Quick::Generic) {
+                if (quick_update(quick, target, operand)) return;
+                quick = Quick::Generic;
+            }
+        }
+
         switch (type) {
             case '=':
-                *scopes.back().intermediates[primary->id] = *scopes.back().intermediates[expression->id];
+                assign(target, registers[expression->reg]);
                 break;
             case '+':
-                arithmetic::op_plus_equality(scopes.back().intermediates[primary->id],
-                                             scopes.back().intermediates[expression->id]);
+                arithmetic::op_plus_equality(target, registers[expression->reg].get());
                 break;
             case '-':
-                arithmetic::op_minus_equality(scopes.back().intermediates[primary->id],
-                                              scopes.back().intermediates[expression->id]);
+                arithmetic::op_minus_equality(target, registers[expression->reg].get());
                 break;
             default:
                 throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
@@ -306,7 +972,7 @@ namespace ast_nodes {
     void PrintNode::execute(std::istream& in, std::ostream& out) {
         for (auto i: values) {
             i->execute(in, out);
-            out << *scopes.back().intermediates[i->id];
+            out << registers[i->reg].get();
         }
     }
 
@@ -319,7 +985,7 @@ namespace ast_nodes {
             case 'r':
 				if (value != nullptr) {
 					value->execute(in, out);
-					return_register = scopes.back().intermediates[value->id];
+					return_register = &registers[value->reg].get();
 				}
                 control_flag = ControlState::Return;
                 break;
@@ -332,9 +998,9 @@ namespace ast_nodes {
     // Handle if statement and execute one of the bodies
     void IfNode::execute(std::istream& in, std::ostream& out) {
         expression->execute(in, out);
-        const arithmetic::AmbiguousVariable* val = scopes.back().intermediates[expression->id];
-        if (val->type == 'b') {
-            if (val->bool_val) {
+        const arithmetic::Value& val = registers[expression->reg].get();
+        if (val.type == 'b') {
+            if (val.bool_val) {
                 if_body->execute(in, out);
             } else if (else_body != nullptr) {
                 else_body->execute(in, out);
@@ -360,13 +1026,13 @@ namespace ast_nodes {
 
 
     void ForNode::execute(std::istream& in, std::ostream& out) {
-        open_scope(this);
+        open_scope(this, 1);
 
         range_expr_l->execute(in, out);
         range_expr_r->execute(in, out);
 
-        arithmetic::AmbiguousVariable* rng_l = scopes.back().intermediates[range_expr_l->id];
-        arithmetic::AmbiguousVariable* rng_r = scopes.back().intermediates[range_expr_r->id];
+        arithmetic::Value* rng_l = &registers[range_expr_l->reg].get();
+        arithmetic::Value* rng_r = &registers[range_expr_r->reg].get();
 
         if (rng_l->type != 'i') {
             throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
@@ -378,10 +1044,11 @@ namespace ast_nodes {
                                                     "Right bound of for loop is not and integer"));
         }
 
-        scopes.back().variables[identifier] = new arithmetic::AmbiguousVariable();
-        scopes.back().variables[identifier]->type = 'i';
+        arithmetic::Value* iterator = arithmetic::new_cell();
+        iterator->type = 'i';
+        scope->variables[slot] = iterator;
         for (long long i = rng_l->int_val; i <= rng_r->int_val; ++i) {
-            scopes.back().variables[identifier]->int_val = i;
+            iterator->int_val = i;
             body->execute(in, out);
             if (control_flag == ControlState::Return) {
                 break;
@@ -398,14 +1065,14 @@ namespace ast_nodes {
 
     bool while_check_cond(WhileNode* node, std::istream& in, std::ostream& out, int pos, int line) {
         node->expression->execute(in, out);
-        arithmetic::AmbiguousVariable* val = scopes.back().intermediates[node->expression->id];
+        const arithmetic::Value& val = registers[node->expression->reg].get();
 
-        if (val->type != 'b') {
+        if (val.type != 'b') {
             throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
                                                     "Expression in while loop does not evaluate to a boolean"));
         }
 
-        return val->bool_val;
+        return val.bool_val;
     }
 
     // Handle while statement and execute the body multiple times
@@ -424,94 +1091,86 @@ namespace ast_nodes {
         }
     }
 
-    // Construct AmbiguousVariable from literal and put it into current scope
+    // Construct Value from literal and put it into current scope
     void LiteralNode::execute(std::istream& in, std::ostream& out) {
-        arithmetic::AmbiguousVariable* lit = new arithmetic::AmbiguousVariable();
-        lit->type = type;
+        if (aggregate != nullptr) {
+            registers[reg].set_value(arithmetic::copy(*aggregate));
+            return;
+        }
 
         switch (type) {
-            case 'i':
-                lit->int_val = int_val;
-                break;
-            case 'r':
-                lit->real_val = real_val;
-                break;
-            case 'b':
-                lit->bool_val = bool_val;
-                break;
-            case 's':
-                lit->string_val = string_val;
-                break;
-            case 'e':
-                break;
             case 'a':
                 array_val->execute(in, out);
-                lit = scopes.back().intermediates[array_val->id];
-                break;
+                registers[reg] = registers[array_val->reg];
+                return;
             case 't':
                 tuple_val->execute(in, out);
-                lit = scopes.back().intermediates[tuple_val->id];
-                break;
+                registers[reg] = registers[tuple_val->reg];
+                return;
             case 'f':
                 func_val->execute(in, out);
-                lit = scopes.back().intermediates[func_val->id];
-                break;
-            default:
-                throw std::invalid_argument(
-                        std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected valid type"));
+                registers[reg] = registers[func_val->reg];
+                return;
         }
 
-        scopes.back().intermediates[id] = lit;
+        if (constant == nullptr) {
+            throw std::invalid_argument(
+                    std::format("Error at line {}, pos {}:\n\t{}", line, pos, "Expected valid type"));
+        }
+        registers[reg].set_value(*constant);
     }
 
     // Construct Array out of expressions and put it into current scope
     void ArrayLiteralNode::execute(std::istream& in, std::ostream& out) {
-        arithmetic::AmbiguousVariable* arr = new arithmetic::AmbiguousVariable();
-        arr->type = 'a';
+        arithmetic::Value arr;
+        arr.type = 'a';
+        arr.array_val = arithmetic::new_array();
+        registers[reg].set_value(arr);
+        arr.array_val->dense.reserve(values.size());
 
         for (int i = 0; i < values.size(); ++i) {
             values[i]->execute(in, out);
-            arr->array_values.push_back(scopes.back().intermediates[values[i]->id]);
-            arr->array_identifiers[i + 1] = i;
+            arr.array_val->insert(i + 1, registers[values[i]->reg].cell());
         }
-        scopes.back().intermediates[id] = arr;
     }
 
     // Construct Tuple out of expressions and put it into current scope
     void TupleLiteralNode::execute(std::istream& in, std::ostream& out) {
-        arithmetic::AmbiguousVariable* tup = new arithmetic::AmbiguousVariable();
-        tup->type = 't';
+        arithmetic::Value tup;
+        tup.type = 't';
+        tup.tuple_val = arithmetic::new_tuple();
+        registers[reg].set_value(tup);
 
+        arithmetic::Shape* built = &arithmetic::root_shape;
         for (int i = 0; i < values.size(); ++i) {
             values[i]->execute(in, out);
-            tup->array_values.push_back(arithmetic::copy(scopes.back().intermediates[values[i]->id]));
-            if (!identifiers[i].empty()) {
-                if (tup->tuple_identifiers.count(identifiers[i])) {
+            tup.tuple_val->array_values.push_back(
+                    arithmetic::new_cell(arithmetic::copy(registers[values[i]->reg].get())));
+            if (shape == nullptr) {
+                built = arithmetic::extend(built, identifiers[i]);
+                if (built == nullptr) {
                     throw std::invalid_argument(std::format("Error at line {}, pos {}:\n\t{}", line, pos,
                                                             "Cannot have multiple entries with same key in tuple"));
                 }
-                tup->tuple_identifiers[identifiers[i]] = i;
             }
         }
-        scopes.back().intermediates[id] = tup;
+        if (shape == nullptr) shape = built;
+        tup.tuple_val->shape = shape;
     }
 
     // Construct Function out of variables and put it into current scope
     void FunctionNode::execute(std::istream& in, std::ostream& out) {
-        arithmetic::AmbiguousVariable* foo = new arithmetic::AmbiguousVariable();
-        foo->type = 'f';
-        foo->function_pointer = this;
-        // -> get all stuff that is currently available
-        for (auto& i: scopes) {
-            for (auto j: i.variables) {
-                foo->function_scope[j.first] = j.second;
-            }
-        }
-        scopes.back().intermediates[id] = foo;
+        arithmetic::Value foo;
+        foo.type = 'f';
+        foo.function_val = arithmetic::new_function(this, capture_scope(this));
+        registers[reg].set_value(foo);
     }
 
     void execute(ast_nodes::Node* tree, std::istream& in=std::cin, std::ostream& out=std::cout) {
+        push_frame(resolver::resolve(tree), nullptr);
+        scope = builtin_scope();
         tree->execute(in, out);
+        pop_frame();
     }
 }
 
@@ -7,6 +7,12 @@
 #include <sstream>
 
 # include "token_data.hpp"
+# include "pool.hpp"
+
+namespace arithmetic {
+    struct Value;
+    struct Shape;
+}
 
 namespace ast_nodes {
 
@@ -21,6 +27,45 @@ namespace ast_nodes {
         return;
     }
 
+    // Variant a self-specializing node turns into on its first run, judging by the operand types it sees.
+    // A variant that meets other types falls back to Generic for good
+    enum class Quick : unsigned char {
+        Uninitialized, Generic,
+        // ExpressionNode with a single operator
+        IntAdd, IntSubtract, IntMultiply, IntDivide,
+        IntLess, IntLessEqual, IntGreater, IntGreaterEqual, IntEqual, IntNotEqual,
+        RealAdd, RealSubtract, RealMultiply, RealDivide,
+        RealLess, RealLessEqual, RealGreater, RealGreaterEqual,
+        // UnaryNode
+        IntNegate, RealNegate, BoolNot,
+        // AssignmentNode updating its target in place
+        IntAddTo, IntSubtractFrom, RealAddTo, RealSubtractFrom
+    };
+
+    // Built-in operation a function computes, recognized by an optimizer from the shape of its body
+    // or given to a builtin
+    enum class Native : unsigned char {
+        None,
+        // Elements l .. r of an array
+        Slice,
+        // Builtins, these never give up and have no body
+        Length, Sum, Min, Max, Find, Reverse, Sort
+    };
+
+    // What the user of a variable primary does with the value its tails reach, decides what the
+    // aggregates along the way have to prepare
+    enum class Access : unsigned char {
+        // Only looked at, shared aggregates need no own copy
+        Read,
+        // Copied or concatenated, aggregates along the way get their own copy
+        Copy,
+        // Its cell may be kept, aggregates along the way get cells and count as aliased
+        Bind,
+        // Target of an assignment, the only place where missing array elements get created. Aggregates
+        // along the way count as aliased, so the assigned value never shares one of them
+        Assign
+    };
+
     class Node {
     public:
         unsigned int id;
@@ -29,6 +74,19 @@ namespace ast_nodes {
         int line = 0;
         int pos = 0;
 
+        // Index of the result register in the enclosing function frame
+        int reg = -1;
+
+        static void* operator new(size_t size) {
+            return pool::allocate(size);
+        }
+
+        static void operator delete(void* memory, size_t size) {
+            pool::deallocate(memory, size);
+        }
+
+        virtual ~Node() = default;
+
         virtual Node* from_tokens(std::vector <tokens::Token>& tokens, int& y) = 0;
 
         virtual void execute(std::istream& in, std::ostream& out) = 0;
@@ -102,6 +160,10 @@ namespace ast_nodes {
         std::string identifier;
         Node* value = nullptr;
 
+        int slot = -1;
+        // Functions created by the initializer refer to the variable being declared
+        bool self_captured = false;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -151,6 +213,15 @@ namespace ast_nodes {
     public:
         std::vector <Node*> terms;
         std::vector <char> ops;
+        // Terms and operators in postfix order, filled in by the resolver
+        std::vector <int> rpn;
+        // Short-circuit jumps for rpn, terms from first_lazy on are only evaluated once they are reached
+        std::vector <int> jumps;
+        int first_lazy = 0;
+        // Only single operators without short-circuit get specialized
+        Quick quick = Quick::Generic;
+        // Has a `+`, whose array and tuple results share element cells with the operands
+        bool concatenates = false;
 
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
@@ -238,6 +309,7 @@ namespace ast_nodes {
         char unaryop = '#';
         Node* primary;
         char type_ind = '#';
+        Quick quick = Quick::Uninitialized;
 
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
@@ -357,6 +429,8 @@ namespace ast_nodes {
         Node* range_expr_r;
         Node* body;
 
+        int slot = -1;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -477,6 +551,14 @@ namespace ast_nodes {
         std::string identifier;
         std::vector <Node*> tails;
 
+        int depth = -1;
+        int slot = -1;
+        // Last tail is a call whose result is returned right away
+        bool tail_call = false;
+        Access access = Access::Bind;
+        // Target of an assignment that stores into the element of the last subscript itself
+        bool stores_element = false;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -597,6 +679,9 @@ namespace ast_nodes {
         long long tuple_idx;
 
         std::string identifier;
+        // Shape of the tuple last accessed through this field and the slot of the field in it
+        arithmetic::Shape* shape = nullptr;
+        long long slot = 0;
 
         Node* subscript;
 
@@ -843,6 +928,10 @@ namespace ast_nodes {
         Node* array_val;
         Node* tuple_val;
         Node* func_val;
+        // Value of a scalar literal, created once by the resolver
+        arithmetic::Value* constant = nullptr;
+        // Prebuilt array or tuple made only of constants, every evaluation gets a copy of it
+        arithmetic::Value* aggregate = nullptr;
 
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
@@ -1023,6 +1112,8 @@ namespace ast_nodes {
     public:
         std::vector <std::string> identifiers;
         std::vector <Node*> values;
+        // Shape of the tuples built here, set once the first one is built
+        arithmetic::Shape* shape = nullptr;
 
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
@@ -1108,6 +1199,14 @@ namespace ast_nodes {
 
         Node* body;
 
+        int register_count = 0;
+        // Depth and slot of every free variable as seen from the scope the function is created in
+        std::vector <std::pair<int, int>> captures;
+        // Calls try the native operation first and run the body only if it gives up
+        Native native = Native::None;
+        // Parameter positions in the order the native operation takes its arguments
+        std::vector <int> native_params;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -1171,12 +1270,54 @@ namespace ast_nodes {
         }
     };
 
+    struct builtin {
+        std::string identifier;
+        Native native;
+        std::vector <std::string> params;
+    };
+
+    // Functions every program can use, declared in a scope around the program so that its own declarations
+    // hide them
+    const std::vector <builtin> builtins = {
+            {"length",  Native::Length,  {"x"}},
+            {"sum",     Native::Sum,     {"arr"}},
+            {"min",     Native::Min,     {"arr"}},
+            {"max",     Native::Max,     {"arr"}},
+            {"find",    Native::Find,    {"arr", "x"}},
+            {"reverse", Native::Reverse, {"arr"}},
+            {"sort",    Native::Sort,    {"arr"}}
+    };
+
+    // Function nodes of the builtins, in the order of builtins
+    const std::vector <FunctionNode*>& builtin_functions() {
+        static std::vector <FunctionNode*> functions;
+        if (functions.empty()) {
+            for (auto& i: builtins) {
+                FunctionNode* foo = new FunctionNode();
+                foo->id = 0;
+                foo->type = 'b';
+                foo->body = nullptr;
+                foo->params = i.params;
+                foo->native = i.native;
+                for (int j = 0; j < i.params.size(); ++j) {
+                    foo->native_params.push_back(j);
+                }
+                functions.push_back(foo);
+            }
+        }
+        return functions;
+    }
+
     class AssignmentNode: public Node {
     public:
         char type;
         Node* primary;
         Node* expression = nullptr;
 
+        // Expression is the target plus one more term, so the target can be extended in place
+        bool self_append = false;
+        Quick quick = Quick::Uninitialized;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -1239,6 +1380,8 @@ namespace ast_nodes {
     public:
         std::vector <Node*> statements;
 
+        int slot_count = 0;
+
         Node* from_tokens(std::vector <tokens::Token>& tokens, int& y);
 
         void execute(std::istream& in, std::ostream& out);
@@ -0,0 +1,338 @@
+#ifndef __TREE_RESOLVE_INCLUDED__
+#define __TREE_RESOLVE_INCLUDED__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ast_nodes.hpp"
+#include "arithmetic.hpp"
+
+namespace ast_nodes {
+    namespace resolver {
+
+        struct binding {
+            std::string identifier;
+            int slot;
+            int level;
+            bool pending;
+            DeclarationNode* declaration;
+        };
+
+        struct scope {
+            Node* owner;
+            int size = 0;
+            std::vector <binding> bindings;
+        };
+
+        // Function being resolved, its parameters live in scopes[scope_base]
+        struct function {
+            FunctionNode* node;
+            int scope_base;
+            // Scope index and slot of each captured variable, parallel to node->captures
+            std::vector <std::pair<int, int>> sources;
+        };
+
+        std::vector <scope> scopes;
+        std::vector <function> functions;
+        int level = 0;
+
+        // Amount of result registers used so far by each function being resolved
+        std::vector <int> register_counts;
+
+        bool produces_value(Node* node) {
+            return dynamic_cast<ExpressionNode*>  (node) != nullptr ||
+                   dynamic_cast<UnaryNode*>       (node) != nullptr ||
+                   dynamic_cast<PrimaryNode*>     (node) != nullptr ||
+                   dynamic_cast<LiteralNode*>     (node) != nullptr ||
+                   dynamic_cast<ArrayLiteralNode*>(node) != nullptr ||
+                   dynamic_cast<TupleLiteralNode*>(node) != nullptr ||
+                   dynamic_cast<FunctionNode*>    (node) != nullptr;
+        }
+
+        // Pending bindings are not visible to their own initializer, only to functions created inside it
+        int declare(const std::string& identifier, bool pending, DeclarationNode* declaration = nullptr) {
+            scope& cur = scopes.back();
+            cur.bindings.push_back({identifier, cur.size, level, pending, declaration});
+            return cur.size++;
+        }
+
+        // Returns the slot of a variable from scopes[index] in the flat environment of functions[depth],
+        // enclosing functions capture it first if it comes from outside of them as well
+        int capture(int depth, int index, int slot) {
+            function& cur = functions[depth];
+            for (int i = 0; i < cur.sources.size(); ++i) {
+                if (cur.sources[i] == std::make_pair(index, slot)) return i;
+            }
+
+            // -> the function is created in scopes[scope_base - 1], environment of the enclosing function
+            // is one above the scope with its parameters
+            if (depth == 0 || index >= functions[depth - 1].scope_base) {
+                cur.node->captures.push_back({cur.scope_base - 1 - index, slot});
+            } else {
+                int outer = capture(depth - 1, index, slot);
+                cur.node->captures.push_back({cur.scope_base - functions[depth - 1].scope_base, outer});
+            }
+            cur.sources.push_back({index, slot});
+            return (int) cur.sources.size() - 1;
+        }
+
+        void lookup(PrimaryNode* primary) {
+            for (int depth = 0; depth < scopes.size(); ++depth) {
+                std::vector <binding>& bindings = scopes[scopes.size() - 1 - depth].bindings;
+
+                for (int i = (signed) bindings.size() - 1; i >= 0; --i) {
+                    if (bindings[i].identifier != primary->identifier) continue;
+                    if (bindings[i].pending && bindings[i].level == level) continue;
+
+                    int index = (int) scopes.size() - 1 - depth;
+                    if (functions.empty() || index >= functions.back().scope_base) {
+                        primary->depth = depth;
+                        primary->slot = bindings[i].slot;
+                        return;
+                    }
+
+                    if (bindings[i].pending && bindings[i].declaration != nullptr) {
+                        bindings[i].declaration->self_captured = true;
+                    }
+                    primary->slot = capture((int) functions.size() - 1, index, bindings[i].slot);
+                    primary->depth = (int) scopes.size() - functions.back().scope_base;
+                    return;
+                }
+            }
+
+            primary->depth = -1;
+            primary->slot = -1;
+        }
+
+        // `return f(...)` inside a function can reuse the activation of the returning function
+        void mark_tail_call(ControlNode* control) {
+            ExpressionNode* expr = dynamic_cast<ExpressionNode*>(control->value);
+            if (expr == nullptr || !expr->ops.empty()) return;
+
+            UnaryNode* unary = dynamic_cast<UnaryNode*>(expr->terms[0]);
+            if (unary == nullptr || unary->unaryop != '#' || unary->type_ind != '#') return;
+
+            PrimaryNode* primary = dynamic_cast<PrimaryNode*>(unary->primary);
+            if (primary == nullptr || primary->type != 'v' || primary->tails.empty()) return;
+
+            TailNode* tail = dynamic_cast<TailNode*>(primary->tails.back());
+            primary->tail_call = tail != nullptr && tail->type == 'p';
+        }
+
+        // `x := x + y` adds y to x in place, the old value of x is not reachable afterwards
+        void mark_self_append(AssignmentNode* assignment) {
+            assignment->self_append = false;
+            if (assignment->type != '=') return;
+
+            PrimaryNode* target = dynamic_cast<PrimaryNode*>(assignment->primary);
+            if (target == nullptr || target->type != 'v' || !target->tails.empty()) return;
+
+            ExpressionNode* expr = dynamic_cast<ExpressionNode*>(assignment->expression);
+            if (expr == nullptr || expr->ops.size() != 1 || expr->ops[0] != '+') return;
+
+            UnaryNode* unary = dynamic_cast<UnaryNode*>(expr->terms[0]);
+            if (unary == nullptr || unary->unaryop != '#' || unary->type_ind != '#') return;
+
+            PrimaryNode* left = dynamic_cast<PrimaryNode*>(unary->primary);
+            if (left == nullptr || left->type != 'v' || !left->tails.empty()) return;
+
+            assignment->self_append = left->depth == target->depth && left->slot == target->slot && target->slot >= 0;
+        }
+
+        Access access_of(PrimaryNode* primary) {
+            AssignmentNode* assignment = dynamic_cast<AssignmentNode*>(primary->parent);
+            if (assignment != nullptr && assignment->primary == primary) return Access::Assign;
+
+            UnaryNode* unary = dynamic_cast<UnaryNode*>(primary->parent);
+            if (unary == nullptr) return Access::Bind;
+            if (unary->unaryop != '#' || unary->type_ind != '#') return Access::Read;
+
+            ExpressionNode* expr = dynamic_cast<ExpressionNode*>(unary->parent);
+            if (expr == nullptr) return Access::Bind;
+            if (!expr->ops.empty()) return expr->concatenates ? Access::Copy : Access::Read;
+
+            Node* user = expr->parent;
+            if (dynamic_cast<PrintNode*>(user) != nullptr || dynamic_cast<IfNode*>(user) != nullptr ||
+                dynamic_cast<WhileNode*>(user) != nullptr) {
+                return Access::Read;
+            }
+            // -> returned values are copied by the caller and tuple literals copy their elements,
+            // only declarations and call arguments keep the cell
+            if (dynamic_cast<AssignmentNode*>(user) != nullptr || dynamic_cast<ControlNode*>(user) != nullptr ||
+                dynamic_cast<TupleLiteralNode*>(user) != nullptr) {
+                return Access::Copy;
+            }
+            return Access::Bind;
+        }
+
+        // Set when the scanned expression calls a function
+        bool has_call = false;
+
+        void find_call(Node* node) {
+            TailNode* tail = dynamic_cast<TailNode*>(node);
+            if (tail != nullptr && tail->type == 'p') has_call = true;
+        }
+
+        // `a[i] := x` with no calls in x can store into the element after x is evaluated, nothing can
+        // change a in between, so packed arrays get the value without making a cell for it
+        void mark_element_store(AssignmentNode* assignment) {
+            PrimaryNode* target = dynamic_cast<PrimaryNode*>(assignment->primary);
+            target->stores_element = false;
+            if (assignment->type == '#' || target->type != 'v' || target->tails.empty()) return;
+
+            TailNode* tail = dynamic_cast<TailNode*>(target->tails.back());
+            if (tail->type != 's') return;
+
+            has_call = false;
+            assignment->expression->visit(find_call, dummy, dummy, false);
+            target->stores_element = !has_call;
+        }
+
+        // Scalar literals are evaluated to the same constant every time
+        void make_constant(LiteralNode* literal) {
+            if (literal->constant != nullptr) return;
+
+            arithmetic::Value value;
+            value.type = literal->type;
+            switch (literal->type) {
+                case 'i':
+                    value.int_val = literal->int_val;
+                    break;
+                case 'r':
+                    value.real_val = literal->real_val;
+                    break;
+                case 'b':
+                    value.bool_val = literal->bool_val;
+                    break;
+                case 's':
+                    value.string_val = arithmetic::new_immortal_string(literal->string_val);
+                    break;
+                case 'e':
+                    break;
+                default:
+                    return;
+            }
+            literal->constant = arithmetic::new_constant(value);
+        }
+
+        void at_enter(Node* node) {
+            BodyNode*        body_node =    dynamic_cast<BodyNode*>       (node);
+            ForNode*         for_node =     dynamic_cast<ForNode*>        (node);
+            FunctionNode*    func_node =    dynamic_cast<FunctionNode*>   (node);
+            DeclarationNode* decl_node =    dynamic_cast<DeclarationNode*>(node);
+            PrimaryNode*     primary_node = dynamic_cast<PrimaryNode*>    (node);
+            ExpressionNode*  expr_node =    dynamic_cast<ExpressionNode*> (node);
+
+            if (produces_value(node)) {
+                node->reg = register_counts.back()++;
+            }
+
+            if (LiteralNode* literal = dynamic_cast<LiteralNode*>(node)) {
+                make_constant(literal);
+            }
+
+            if (expr_node != nullptr) {
+                expr_node->concatenates = std::find(expr_node->ops.begin(), expr_node->ops.end(), '+') !=
+                                          expr_node->ops.end();
+                arithmetic::expression_order(expr_node->ops, expr_node->rpn);
+                arithmetic::short_circuit_jumps(expr_node->rpn, expr_node->jumps);
+
+                // -> terms are first used in order, from the first one used inside a range that may be skipped
+                // on they are evaluated during the walk
+                expr_node->first_lazy = expr_node->terms.size();
+                int skipped_until = -1;
+                int next_term = 0;
+                for (int i = 0; i < expr_node->rpn.size(); ++i) {
+                    skipped_until = std::max(skipped_until, expr_node->jumps[i]);
+                    if (expr_node->rpn[i] != next_term) continue;
+                    if (i < skipped_until) {
+                        expr_node->first_lazy = next_term;
+                        break;
+                    }
+                    ++next_term;
+                }
+
+                expr_node->quick = expr_node->rpn.size() == 3 && expr_node->first_lazy == 2 ?
+                                   Quick::Uninitialized : Quick::Generic;
+            }
+
+            if (body_node != nullptr) {
+                ForNode* loop = dynamic_cast<ForNode*>(node->parent);
+                if (loop != nullptr && loop->body == node) {
+                    // Iterator is declared after the range is evaluated
+                    scopes.back().bindings.back().pending = false;
+                }
+                scopes.push_back({node});
+            } else if (for_node != nullptr) {
+                scopes.push_back({node});
+                for_node->slot = declare(for_node->identifier, true);
+            } else if (func_node != nullptr) {
+                ++level;
+                register_counts.push_back(0);
+                func_node->captures.clear();
+                functions.push_back({func_node, (int) scopes.size()});
+                scopes.push_back({node});
+                for (auto& i: func_node->params) {
+                    declare(i, false);
+                }
+            } else if (decl_node != nullptr) {
+                decl_node->self_captured = false;
+                decl_node->slot = declare(decl_node->identifier, true, decl_node);
+            } else if (primary_node != nullptr && primary_node->type == 'v') {
+                primary_node->tail_call = false;
+                primary_node->access = access_of(primary_node);
+                lookup(primary_node);
+            }
+        }
+
+        void at_exit(Node* node) {
+            BodyNode*        body_node = dynamic_cast<BodyNode*>       (node);
+            DeclarationNode* decl_node = dynamic_cast<DeclarationNode*>(node);
+            FunctionNode*    func_node = dynamic_cast<FunctionNode*>   (node);
+            ControlNode*     ctrl_node = dynamic_cast<ControlNode*>    (node);
+            AssignmentNode*  asgn_node = dynamic_cast<AssignmentNode*> (node);
+
+            if (body_node != nullptr) {
+                body_node->slot_count = scopes.back().size;
+                scopes.pop_back();
+            } else if (dynamic_cast<ForNode*>(node) != nullptr) {
+                scopes.pop_back();
+            } else if (func_node != nullptr) {
+                func_node->register_count = register_counts.back();
+                register_counts.pop_back();
+                functions.pop_back();
+                scopes.pop_back();
+                --level;
+            } else if (decl_node != nullptr) {
+                scopes.back().bindings[decl_node->slot].pending = false;
+            } else if (ctrl_node != nullptr && ctrl_node->type == 'r' && !functions.empty()) {
+                mark_tail_call(ctrl_node);
+            } else if (asgn_node != nullptr) {
+                mark_self_append(asgn_node);
+                mark_element_store(asgn_node);
+            }
+        }
+
+        // Annotates variable references with the amount of scopes to go up and the slot to read,
+        // returns the amount of result registers needed by the top level code
+        int resolve(Node* tree) {
+            scopes.clear();
+            functions.clear();
+            level = 0;
+            register_counts.assign(1, 0);
+
+            // -> the scope of the builtins is the outermost one at run time as well
+            scopes.push_back({nullptr});
+            for (auto& i: builtins) {
+                declare(i.identifier, false);
+            }
+
+            assign_parents(tree);
+            tree->visit(at_enter, dummy, at_exit);
+            return register_counts.back();
+        }
+    }
+}
+
+#endif // __TREE_RESOLVE_INCLUDED__
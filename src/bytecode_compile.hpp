@@ -0,0 +1,531 @@
+#ifndef __BYTECODE_COMPILE_INCLUDED__
+#define __BYTECODE_COMPILE_INCLUDED__
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stack>
+#include <unordered_map>
+
+#include "ast_lib.hpp"
+#include "arithmetic.hpp"
+
+namespace bytecode {
+
+    enum OpCode {
+        // Values
+        opLiteral,       // push constant of scalar LiteralNode
+        opReadInt,       // push value read from input
+        opReadReal,
+        opReadString,
+        opLoad,          // push variable named by PrimaryNode
+        opPick,          // push copy of stack value arg positions below the top
+        opSlide,         // keep top value, drop arg values below it
+        opPop,           // drop top value
+        opReserve,       // push arg empty values
+        opPut,           // store copy of top value arg positions below the top
+
+        // Tails
+        opTupleIndex,    // replace top with tuple element by position (arg is the Access of the primary)
+        opTupleField,    // replace top with tuple element by name (arg as for opTupleIndex)
+        opSubscript,     // pop subscript, replace top with array element (arg as for opTupleIndex)
+        opCall,          // call function below arg arguments
+        opTailCall,      // call function below arg arguments in place of the running function
+
+        // Operators
+        opBinary,        // pop two values, push result of operator arg
+        opUnary,         // replace top with result of UnaryNode operator
+
+        // Aggregates
+        opMakeArray,     // pop arg values, push array made of them
+        opMakeTuple,     // pop arg values, push tuple made of them
+        opMakeFunction,  // push function capturing current scopes
+        opCopyAggregate, // push copy of prebuilt aggregate of LiteralNode
+
+        // Statements
+        opDeclare,       // pop value and bind it to declared identifier (or store it into the bound cell)
+        opDeclareEmpty,  // bind new empty value to declared identifier
+        opAppend,        // pop value and add it to the target below in place
+        opAssign,        // pop value and target, assign according to AssignmentNode
+        opElementTarget, // prepare store into array below subscript, keeping both
+        opStoreElement,  // pop value, subscript and array, assign according to AssignmentNode
+        opPrint,         // pop value and print it
+
+        // Control flow
+        opJump,          // continue from instruction arg
+        opAndSkip,       // jump to arg keeping top value if it is false
+        opOrSkip,        // jump to arg keeping top value if it is true
+        opIfFalse,       // pop condition of if statement, jump to arg if false
+        opWhileFalse,    // pop condition of while loop, jump to arg if false
+        opOpenScope,     // open scope with arg slots
+        opCloseScope,    // close arg innermost scopes
+        opForInit,       // pop range bounds, declare iterator and start loop
+        opForTest,       // jump to arg if loop is over, update iterator otherwise
+        opForStep,
+        opForExit,
+        opReturn,        // pop value into return register and leave function
+        opReturnNone,    // leave function returning empty
+        opHalt
+    };
+
+    struct Instruction {
+        OpCode op;
+        long long arg = 0;
+        ast_nodes::Node* node = nullptr;
+
+        int line = 0;
+        int pos = 0;
+    };
+
+    struct Chunk {
+        std::vector <Instruction> code;
+        ast_nodes::FunctionNode* function = nullptr;
+    };
+
+    struct Program {
+        std::vector <Chunk*> chunks;
+        std::unordered_map<ast_nodes::FunctionNode*, Chunk*> functions;
+    };
+
+    class Compiler {
+    private:
+        struct LoopInfo {
+            int depth;
+            std::vector<int> breaks;
+            std::vector<int> continues;
+        };
+
+        Program* program;
+        Chunk* chunk;
+        int depth = 0;
+        std::vector <LoopInfo> loops;
+
+        int emit(OpCode op, ast_nodes::Node* node, long long arg = 0) {
+            Instruction ins;
+            ins.op = op;
+            ins.arg = arg;
+            ins.node = node;
+            ins.line = node ? node->line : 0;
+            ins.pos = node ? node->pos : 0;
+            chunk->code.push_back(ins);
+            return chunk->code.size() - 1;
+        }
+
+        int here() {
+            return chunk->code.size();
+        }
+
+        void patch(int at, int target) {
+            chunk->code[at].arg = target;
+        }
+
+        void close_scopes(int amount, ast_nodes::Node* node) {
+            if (amount > 0) emit(opCloseScope, node, amount);
+        }
+
+        void compile_statement(ast_nodes::Node* node) {
+            if (auto decl = dynamic_cast<ast_nodes::DeclarationNode*>(node)) {
+                if (decl->value != nullptr) {
+                    // -> functions created by the initializer capture the cell before it gets its value
+                    if (decl->self_captured) emit(opDeclareEmpty, decl);
+                    compile_expression(decl->value);
+                    emit(opDeclare, decl);
+                } else {
+                    emit(opDeclareEmpty, decl);
+                }
+            } else if (auto asgn = dynamic_cast<ast_nodes::AssignmentNode*>(node)) {
+                ast_nodes::PrimaryNode* target = dynamic_cast<ast_nodes::PrimaryNode*>(asgn->primary);
+                compile_primary(target);
+                if (asgn->type == '#') {
+                    emit(opPop, asgn);
+                } else if (asgn->self_append) {
+                    ast_nodes::ExpressionNode* expr = dynamic_cast<ast_nodes::ExpressionNode*>(asgn->expression);
+                    compile_unary(expr->terms[1]);
+                    emit(opAppend, expr);
+                } else if (target->stores_element) {
+                    compile_expression(dynamic_cast<ast_nodes::TailNode*>(target->tails.back())->subscript);
+                    int at = emit(opElementTarget, asgn);
+                    chunk->code[at].line = target->line;
+                    chunk->code[at].pos = target->pos;
+                    compile_expression(asgn->expression);
+                    emit(opStoreElement, asgn);
+                } else {
+                    compile_expression(asgn->expression);
+                    emit(opAssign, asgn);
+                }
+            } else if (auto print = dynamic_cast<ast_nodes::PrintNode*>(node)) {
+                for (auto i: print->values) {
+                    compile_expression(i);
+                    emit(opPrint, print);
+                }
+            } else if (auto control = dynamic_cast<ast_nodes::ControlNode*>(node)) {
+                compile_control(control);
+            } else if (auto if_node = dynamic_cast<ast_nodes::IfNode*>(node)) {
+                compile_expression(if_node->expression);
+                int to_else = emit(opIfFalse, if_node);
+                compile_body(if_node->if_body);
+                if (if_node->else_body != nullptr) {
+                    int to_end = emit(opJump, if_node);
+                    patch(to_else, here());
+                    compile_body(if_node->else_body);
+                    patch(to_end, here());
+                } else {
+                    patch(to_else, here());
+                }
+            } else if (auto for_node = dynamic_cast<ast_nodes::ForNode*>(node)) {
+                compile_for(for_node);
+            } else if (auto while_node = dynamic_cast<ast_nodes::WhileNode*>(node)) {
+                compile_while(while_node);
+            } else if (auto body = dynamic_cast<ast_nodes::BodyNode*>(node)) {
+                compile_body(body);
+            } else {
+                throw std::invalid_argument(
+                        std::format("Error at line {}, pos {}:\n\t{}", node->line, node->pos, "Not a statement"));
+            }
+        }
+
+        void compile_body(ast_nodes::Node* node) {
+            ast_nodes::BodyNode* body = dynamic_cast<ast_nodes::BodyNode*>(node);
+
+            emit(opOpenScope, body, body->slot_count);
+            ++depth;
+            for (auto i: body->statements) {
+                compile_statement(i);
+            }
+            --depth;
+            emit(opCloseScope, body, 1);
+        }
+
+        void compile_control(ast_nodes::ControlNode* control) {
+            switch (control->type) {
+                case 'b':
+                    close_scopes(depth - loops.back().depth, control);
+                    loops.back().breaks.push_back(emit(opJump, control));
+                    break;
+                case 'c':
+                    close_scopes(depth - loops.back().depth, control);
+                    loops.back().continues.push_back(emit(opJump, control));
+                    break;
+                case 'r':
+                    if (control->value != nullptr) {
+                        compile_expression(control->value);
+                        emit(opReturn, control);
+                    } else {
+                        emit(opReturnNone, control);
+                    }
+                    break;
+            }
+        }
+
+        void compile_for(ast_nodes::ForNode* node) {
+            emit(opOpenScope, node, 1);
+            ++depth;
+
+            compile_expression(node->range_expr_l);
+            compile_expression(node->range_expr_r);
+            emit(opForInit, node);
+
+            int test = emit(opForTest, node);
+
+            loops.push_back({depth, {}, {}});
+            compile_body(node->body);
+            LoopInfo loop = loops.back();
+            loops.pop_back();
+
+            int step = emit(opForStep, node);
+            emit(opJump, node, test);
+
+            int exit = emit(opForExit, node);
+            patch(test, exit);
+
+            for (int i: loop.breaks) patch(i, exit);
+            for (int i: loop.continues) patch(i, step);
+
+            --depth;
+            emit(opCloseScope, node, 1);
+        }
+
+        void compile_while(ast_nodes::WhileNode* node) {
+            int test = here();
+            compile_expression(node->expression);
+            int to_exit = emit(opWhileFalse, node);
+
+            loops.push_back({depth, {}, {}});
+            compile_body(node->body);
+            LoopInfo loop = loops.back();
+            loops.pop_back();
+
+            emit(opJump, node, test);
+            patch(to_exit, here());
+
+            for (int i: loop.breaks) patch(i, here());
+            for (int i: loop.continues) patch(i, test);
+        }
+
+        void compile_expression(ast_nodes::Node* node) {
+            ast_nodes::ExpressionNode* expr = dynamic_cast<ast_nodes::ExpressionNode*>(node);
+
+            if (expr->first_lazy < expr->terms.size()) {
+                compile_short_circuit(expr);
+                return;
+            }
+
+            for (auto i: expr->terms) {
+                compile_unary(i);
+            }
+
+            if (expr->ops.empty()) return;
+
+            const std::vector<int>& rpn = expr->rpn;
+
+            // Terms already lie on the stack in the order postfix notation needs them
+            bool in_place = true;
+            int next_term = 0;
+            for (int i: rpn) {
+                if (i >= 0) {
+                    if (i != next_term) in_place = false;
+                    ++next_term;
+                } else if (next_term != expr->terms.size()) {
+                    in_place = false;
+                }
+            }
+
+            if (in_place) {
+                for (int i: rpn) {
+                    if (i < 0) emit(opBinary, expr, -1 - i);
+                }
+                return;
+            }
+
+            int above = 0;
+            for (int i: rpn) {
+                if (i >= 0) {
+                    emit(opPick, expr, (long long) expr->terms.size() - 1 - i + above);
+                    ++above;
+                } else {
+                    emit(opBinary, expr, -1 - i);
+                    --above;
+                }
+            }
+            emit(opSlide, expr, expr->terms.size());
+        }
+
+        // Terms before first_lazy are pushed up front, the rest are compiled where rpn reaches them.
+        // Lazy terms that relation chains use twice get a reserved slot next to the up front ones
+        void compile_short_circuit(ast_nodes::ExpressionNode* expr) {
+            const std::vector<int>& rpn = expr->rpn;
+            const std::vector<int>& jumps = expr->jumps;
+
+            std::vector<int> uses(expr->terms.size(), 0);
+            for (int i: rpn) {
+                if (i >= 0) ++uses[i];
+            }
+
+            // -> slot of every term kept below the evaluation, -1 for lazy terms used once
+            std::vector<int> slot(expr->terms.size(), -1);
+            int slots = 0;
+            for (int i = 0; i < expr->terms.size(); ++i) {
+                if (i < expr->first_lazy || uses[i] > 1) slot[i] = slots++;
+            }
+
+            for (int i = 0; i < expr->first_lazy; ++i) {
+                compile_unary(expr->terms[i]);
+            }
+            if (slots > expr->first_lazy) emit(opReserve, expr, slots - expr->first_lazy);
+
+            std::vector<bool> compiled(expr->terms.size(), false);
+            for (int i = 0; i < expr->first_lazy; ++i) compiled[i] = true;
+
+            // -> skip instructions waiting for the position after their operator
+            std::vector<std::vector<int>> skips(rpn.size());
+            int above = 0;
+            for (int k = 0; k < rpn.size(); ++k) {
+                if (jumps[k] >= 0) {
+                    skips[jumps[k]].push_back(emit(rpn[jumps[k]] == -1 - 'a' ? opAndSkip : opOrSkip, expr));
+                }
+
+                int i = rpn[k];
+                if (i < 0) {
+                    emit(opBinary, expr, -1 - i);
+                    --above;
+                    for (int at: skips[k]) patch(at, here());
+                } else if (compiled[i]) {
+                    emit(opPick, expr, (long long) slots - 1 - slot[i] + above);
+                    ++above;
+                } else {
+                    compile_unary(expr->terms[i]);
+                    compiled[i] = true;
+                    ++above;
+                    if (slot[i] >= 0) emit(opPut, expr, (long long) slots - 1 - slot[i] + above);
+                }
+            }
+            if (slots > 0) emit(opSlide, expr, slots);
+        }
+
+        void compile_unary(ast_nodes::Node* node) {
+            ast_nodes::UnaryNode* unary = dynamic_cast<ast_nodes::UnaryNode*>(node);
+
+            compile_primary(unary->primary);
+
+            if (unary->unaryop != '#' || unary->type_ind != '#') {
+                emit(opUnary, unary);
+            }
+        }
+
+        void compile_primary(ast_nodes::Node* node) {
+            ast_nodes::PrimaryNode* primary = dynamic_cast<ast_nodes::PrimaryNode*>(node);
+
+            switch (primary->type) {
+                case 'i':
+                    emit(opReadInt, primary);
+                    break;
+                case 'r':
+                    emit(opReadReal, primary);
+                    break;
+                case 's':
+                    emit(opReadString, primary);
+                    break;
+                case 'v':
+                    emit(opLoad, primary);
+                    for (auto i: primary->tails) {
+                        // -> the assignment compiles the last subscript itself
+                        if (primary->stores_element && i == primary->tails.back()) break;
+                        compile_tail(primary, dynamic_cast<ast_nodes::TailNode*>(i));
+                    }
+                    break;
+                case 'l':
+                    compile_literal(primary->literal);
+                    break;
+                case 'e':
+                    compile_expression(primary->expression);
+                    break;
+                default:
+                    throw std::invalid_argument(
+                            std::format("Error at line {}, pos {}:\n\t{}", primary->line, primary->pos,
+                                        "Expected valid type"));
+            }
+        }
+
+        // Tail errors are reported at the position of the primary they belong to
+        void compile_tail(ast_nodes::PrimaryNode* primary, ast_nodes::TailNode* tail) {
+            int at;
+            switch (tail->type) {
+                case 't':
+                    at = emit(opTupleIndex, tail, (long long) primary->access);
+                    break;
+                case 'i':
+                    at = emit(opTupleField, tail, (long long) primary->access);
+                    break;
+                case 'p':
+                    for (auto i: tail->params) {
+                        compile_expression(i);
+                    }
+                    if (primary->tail_call && tail == primary->tails.back()) {
+                        at = emit(opTailCall, tail, tail->params.size());
+                    } else {
+                        at = emit(opCall, tail, tail->params.size());
+                    }
+                    break;
+                case 's':
+                    compile_expression(tail->subscript);
+                    at = emit(opSubscript, tail, (long long) primary->access);
+                    break;
+                default:
+                    throw std::invalid_argument(
+                            std::format("Error at line {}, pos {}:\n\t{}", primary->line, primary->pos,
+                                        "Expected valid type"));
+            }
+            chunk->code[at].line = primary->line;
+            chunk->code[at].pos = primary->pos;
+        }
+
+        void compile_literal(ast_nodes::Node* node) {
+            ast_nodes::LiteralNode* literal = dynamic_cast<ast_nodes::LiteralNode*>(node);
+
+            if (literal->aggregate != nullptr) {
+                emit(opCopyAggregate, literal);
+                return;
+            }
+
+            switch (literal->type) {
+                case 'i':
+                case 'r':
+                case 'b':
+                case 's':
+                case 'e':
+                    emit(opLiteral, literal);
+                    break;
+                case 'a': {
+                    ast_nodes::ArrayLiteralNode* arr = dynamic_cast<ast_nodes::ArrayLiteralNode*>(literal->array_val);
+                    for (auto i: arr->values) {
+                        compile_expression(i);
+                    }
+                    emit(opMakeArray, arr, arr->values.size());
+                    break;
+                }
+                case 't': {
+                    ast_nodes::TupleLiteralNode* tup = dynamic_cast<ast_nodes::TupleLiteralNode*>(literal->tuple_val);
+                    for (auto i: tup->values) {
+                        compile_expression(i);
+                    }
+                    emit(opMakeTuple, tup, tup->values.size());
+                    break;
+                }
+                case 'f':
+                    compile_function(dynamic_cast<ast_nodes::FunctionNode*>(literal->func_val));
+                    emit(opMakeFunction, literal->func_val);
+                    break;
+                default:
+                    throw std::invalid_argument(
+                            std::format("Error at line {}, pos {}:\n\t{}", literal->line, literal->pos,
+                                        "Expected valid type"));
+            }
+        }
+
+        void compile_function(ast_nodes::FunctionNode* foo) {
+            Chunk* outer_chunk = chunk;
+            int outer_depth = depth;
+            std::vector <LoopInfo> outer_loops;
+            outer_loops.swap(loops);
+
+            chunk = new Chunk();
+            chunk->function = foo;
+            program->chunks.push_back(chunk);
+            program->functions[foo] = chunk;
+            depth = 0;
+
+            if (foo->type == 'l') {
+                compile_expression(foo->body);
+                emit(opReturn, foo);
+            } else {
+                compile_body(foo->body);
+                emit(opReturnNone, foo);
+            }
+
+            chunk = outer_chunk;
+            depth = outer_depth;
+            loops.swap(outer_loops);
+        }
+
+    public:
+        Program* compile(ast_nodes::Node* tree) {
+            program = new Program();
+            chunk = new Chunk();
+            program->chunks.push_back(chunk);
+            depth = 0;
+            loops.clear();
+
+            compile_body(tree);
+            emit(opHalt, tree);
+
+            return program;
+        }
+    };
+
+    Program* compile(ast_nodes::Node* tree) {
+        Compiler compiler;
+        return compiler.compile(tree);
+    }
+}
+
+#endif // __BYTECODE_COMPILE_INCLUDED__
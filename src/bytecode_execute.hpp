@@ -0,0 +1,541 @@
+#ifndef __BYTECODE_EXECUTE_INCLUDED__
+#define __BYTECODE_EXECUTE_INCLUDED__
+
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "ast_lib.hpp"
+#include "arithmetic.hpp"
+#include "bytecode_compile.hpp"
+
+namespace bytecode {
+
+    struct Frame {
+        Chunk* chunk;
+        int ip;
+        size_t stack_base;
+        size_t loop_base;
+        ast_nodes::scopeinfo* caller;
+        ast_nodes::scopeinfo* callee;
+    };
+
+    struct LoopState {
+        long long i;
+        ast_nodes::Operand rng_r;
+        arithmetic::Value* iterator;
+    };
+
+    std::string error_at(const Instruction& ins, const char* what) {
+        return std::format("Error at line {}, pos {}:\n\t{}", ins.line, ins.pos, what);
+    }
+
+    std::string evaluation_error_at(const Instruction& ins, const char* what) {
+        return std::format("Evaluation error at line {}, pos {}:\n\t{}", ins.line, ins.pos, what);
+    }
+
+    void run(Program* program, std::istream& in, std::ostream& out) {
+        using arithmetic::Value;
+        using ast_nodes::Access;
+        using ast_nodes::Operand;
+        using ast_nodes::scope;
+
+        std::vector <Operand> stack;
+        std::vector <Frame> frames;
+        std::vector <LoopState> loops;
+
+        Chunk* chunk = program->chunks[0];
+        Instruction* code = chunk->code.data();
+        int ip = 0;
+
+        // Closes the running function and hands result to its caller
+        auto leave_frame = [&](const Value& result) {
+            Frame frame = frames.back();
+            frames.pop_back();
+
+            while (scope != frame.callee) {
+                ast_nodes::close_scope();
+            }
+            ast_nodes::release_scope(frame.callee);
+            scope = frame.caller;
+            loops.resize(frame.loop_base);
+            stack.resize(frame.stack_base);
+            stack.emplace_back().set_value(result);
+
+            chunk = frame.chunk;
+            code = chunk->code.data();
+            ip = frame.ip;
+        };
+
+        while (true) {
+            Instruction& ins = code[ip++];
+
+            switch (ins.op) {
+                case opLiteral: {
+                    ast_nodes::LiteralNode* literal = static_cast<ast_nodes::LiteralNode*>(ins.node);
+                    stack.emplace_back().set_value(*literal->constant);
+                    break;
+                }
+                case opReadInt: {
+                    Value inputted_value;
+                    inputted_value.type = 'i';
+                    in >> inputted_value.int_val;
+                    stack.emplace_back().set_value(inputted_value);
+                    break;
+                }
+                case opReadReal: {
+                    Value inputted_value;
+                    inputted_value.type = 'r';
+                    in >> inputted_value.real_val;
+                    stack.emplace_back().set_value(inputted_value);
+                    break;
+                }
+                case opReadString: {
+                    Value inputted_value;
+                    inputted_value.type = 's';
+                    inputted_value.string_val = arithmetic::new_string("");
+                    in >> inputted_value.string_val->value;
+                    stack.emplace_back().set_value(inputted_value);
+                    break;
+                }
+                case opLoad:
+                    stack.emplace_back().set_cell(ast_nodes::get_variable(static_cast<ast_nodes::PrimaryNode*>(ins.node)));
+                    break;
+                case opPick: {
+                    Operand picked = stack[stack.size() - 1 - ins.arg];
+                    stack.push_back(picked);
+                    break;
+                }
+                case opSlide: {
+                    Operand top = stack.back();
+                    stack.resize(stack.size() - ins.arg);
+                    stack.back() = top;
+                    break;
+                }
+                case opPop:
+                    stack.pop_back();
+                    break;
+                case opReserve:
+                    stack.resize(stack.size() + ins.arg);
+                    break;
+                case opPut:
+                    stack[stack.size() - 1 - ins.arg] = stack.back();
+                    break;
+
+                case opTupleIndex: {
+                    ast_nodes::TailNode* tail = static_cast<ast_nodes::TailNode*>(ins.node);
+                    Access access = (Access) ins.arg;
+                    Value& var = stack.back().get();
+                    ast_nodes::prepare(var, access);
+                    if (var.type != 't') {
+                        throw std::invalid_argument(error_at(ins, "Expected tuple"));
+                    }
+                    if (tail->tuple_idx < 1 || tail->tuple_idx > (long long) var.tuple_val->array_values.size()) {
+                        throw std::invalid_argument(error_at(ins, "Tuple index out of range"));
+                    }
+                    stack.back().set_cell(var.tuple_val->array_values[tail->tuple_idx - 1]);
+                    if (access == Access::Read) arithmetic::share_element(var, stack.back().get());
+                    break;
+                }
+                case opTupleField: {
+                    ast_nodes::TailNode* tail = static_cast<ast_nodes::TailNode*>(ins.node);
+                    Access access = (Access) ins.arg;
+                    Value& var = stack.back().get();
+                    ast_nodes::prepare(var, access);
+                    if (var.type != 't') {
+                        throw std::invalid_argument(error_at(ins, "Expected tuple"));
+                    }
+                    long long slot = ast_nodes::field_slot(tail, var.tuple_val);
+                    if (slot < 0) {
+                        throw std::invalid_argument(error_at(ins, "Tuple identifier not present"));
+                    }
+                    stack.back().set_cell(var.tuple_val->array_values[slot]);
+                    if (access == Access::Read) arithmetic::share_element(var, stack.back().get());
+                    break;
+                }
+                case opSubscript: {
+                    Access access = (Access) ins.arg;
+                    Value sub = stack.back().get();
+                    stack.pop_back();
+                    Value& var = stack.back().get();
+                    ast_nodes::prepare(var, access);
+                    if (var.type != 'a') {
+                        throw std::invalid_argument(error_at(ins, "Expected array"));
+                    }
+                    if (sub.type != 'i') {
+                        throw std::invalid_argument(error_at(ins, "Expected integer as array index"));
+                    }
+                    Value element;
+                    if (access == Access::Assign) {
+                        stack.back().set_cell(arithmetic::array_element(var.array_val, sub.int_val));
+                    } else if (var.array_val->packing != 0) {
+                        stack.back().set_value(arithmetic::packed_element(*var.array_val, sub.int_val, element) ?
+                                               element : ast_nodes::constempty);
+                    } else if (Value* found = var.array_val->find(sub.int_val)) {
+                        stack.back().set_cell(found);
+                        if (access == Access::Read) arithmetic::share_element(var, *found);
+                    } else {
+                        stack.back().set_value(ast_nodes::constempty);
+                    }
+                    break;
+                }
+                case opCall: {
+                    size_t callee = stack.size() - 1 - ins.arg;
+                    Value& var = stack[callee].get();
+                    if (var.type != 'f') {
+                        throw std::invalid_argument(error_at(ins, "Expected function"));
+                    }
+
+                    ast_nodes::FunctionNode* foo = var.function_val->function_pointer;
+
+                    if (foo->params.size() != ins.arg) {
+                        throw std::invalid_argument(std::format(
+                                "Error at line {}, pos {}:\n\tArgument amount mismatch: Expected: {} got: {}", ins.line,
+                                ins.pos, foo->params.size(), ins.arg));
+                    }
+
+                    Value native_result;
+                    if (foo->native != ast_nodes::Native::None &&
+                        ast_nodes::call_native(foo, [&](int j) -> Value& { return stack[callee + 1 + j].get(); },
+                                               native_result, ins.line, ins.pos)) {
+                        stack.resize(callee + 1);
+                        stack.back().set_value(native_result);
+                        break;
+                    }
+
+                    ast_nodes::scopeinfo* caller = scope;
+                    ast_nodes::open_scope(ins.node, foo->params.size(), var.function_val->function_scope);
+                    frames.push_back({chunk, ip, callee, loops.size(), caller, scope});
+
+                    for (int j = 0; j < foo->params.size(); ++j) {
+                        scope->variables[j] = stack[callee + 1 + j].cell();
+                    }
+
+                    ast_nodes::return_register = &ast_nodes::constempty;
+
+                    chunk = program->functions[foo];
+                    code = chunk->code.data();
+                    ip = 0;
+                    break;
+                }
+
+                case opTailCall: {
+                    size_t callee = stack.size() - 1 - ins.arg;
+                    Value& var = stack[callee].get();
+                    if (var.type != 'f') {
+                        throw std::invalid_argument(error_at(ins, "Expected function"));
+                    }
+
+                    ast_nodes::FunctionNode* foo = var.function_val->function_pointer;
+
+                    if (foo->params.size() != ins.arg) {
+                        throw std::invalid_argument(std::format(
+                                "Error at line {}, pos {}:\n\tArgument amount mismatch: Expected: {} got: {}", ins.line,
+                                ins.pos, foo->params.size(), ins.arg));
+                    }
+
+                    Value native_result;
+                    if (foo->native != ast_nodes::Native::None &&
+                        ast_nodes::call_native(foo, [&](int j) -> Value& { return stack[callee + 1 + j].get(); },
+                                               native_result, ins.line, ins.pos)) {
+                        leave_frame(native_result);
+                        break;
+                    }
+
+                    // -> the running function is left first, the call returns straight to its caller
+                    Frame& frame = frames.back();
+                    while (scope != frame.callee) {
+                        ast_nodes::close_scope();
+                    }
+                    ast_nodes::release_scope(frame.callee);
+                    scope = frame.caller;
+                    loops.resize(frame.loop_base);
+
+                    ast_nodes::open_scope(ins.node, foo->params.size(), var.function_val->function_scope);
+                    frame.callee = scope;
+
+                    for (int j = 0; j < foo->params.size(); ++j) {
+                        scope->variables[j] = stack[callee + 1 + j].cell();
+                    }
+                    stack[frame.stack_base] = stack[callee];
+                    stack.resize(frame.stack_base + 1);
+
+                    ast_nodes::return_register = &ast_nodes::constempty;
+
+                    chunk = program->functions[foo];
+                    code = chunk->code.data();
+                    ip = 0;
+                    break;
+                }
+
+                case opBinary: {
+                    Operand& a = stack[stack.size() - 2];
+                    if (ins.arg == '+') {
+                        ast_nodes::expose_term(a);
+                        ast_nodes::expose_term(stack.back());
+                    }
+                    try {
+                        a.set_value(arithmetic::apply_operator(a.get(), stack.back().get(), (char) ins.arg));
+                        stack.pop_back();
+                    } catch (std::invalid_argument& ex) {
+                        throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                    } catch (std::runtime_error& ex) {
+                        throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                    }
+                    break;
+                }
+                case opUnary: {
+                    ast_nodes::UnaryNode* unary = static_cast<ast_nodes::UnaryNode*>(ins.node);
+                    Operand& new_term = stack.back();
+                    try {
+                        if (unary->unaryop != '#') {
+                            new_term.set_value(arithmetic::perform_unary_op(unary->unaryop, new_term.get()));
+                        }
+                    } catch (std::invalid_argument& ex) {
+                        throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                    } catch (std::runtime_error& ex) {
+                        throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                    }
+
+                    if (unary->type_ind != '#') {
+                        Value is_type;
+                        is_type.type = 'b';
+                        is_type.bool_val = (unary->type_ind == new_term.get().type);
+                        new_term.set_value(is_type);
+                    }
+                    break;
+                }
+
+                case opMakeArray: {
+                    Value arr;
+                    arr.type = 'a';
+                    arr.array_val = arithmetic::new_array();
+                    size_t first = stack.size() - ins.arg;
+                    arr.array_val->dense.reserve(ins.arg);
+                    for (int i = 0; i < ins.arg; ++i) {
+                        arr.array_val->insert(i + 1, stack[first + i].cell());
+                    }
+                    stack.resize(first);
+                    stack.emplace_back().set_value(arr);
+                    break;
+                }
+                case opMakeTuple: {
+                    ast_nodes::TupleLiteralNode* node = static_cast<ast_nodes::TupleLiteralNode*>(ins.node);
+                    Value tup;
+                    tup.type = 't';
+                    tup.tuple_val = arithmetic::new_tuple();
+                    size_t first = stack.size() - ins.arg;
+                    arithmetic::Shape* built = &arithmetic::root_shape;
+                    for (int i = 0; i < ins.arg; ++i) {
+                        tup.tuple_val->array_values.push_back(arithmetic::new_cell(arithmetic::copy(stack[first + i].get())));
+                        if (node->shape == nullptr) {
+                            built = arithmetic::extend(built, node->identifiers[i]);
+                            if (built == nullptr) {
+                                throw std::invalid_argument(
+                                        error_at(ins, "Cannot have multiple entries with same key in tuple"));
+                            }
+                        }
+                    }
+                    if (node->shape == nullptr) node->shape = built;
+                    tup.tuple_val->shape = node->shape;
+                    stack.resize(first);
+                    stack.emplace_back().set_value(tup);
+                    break;
+                }
+                case opMakeFunction: {
+                    Value foo;
+                    foo.type = 'f';
+                    ast_nodes::FunctionNode* node = static_cast<ast_nodes::FunctionNode*>(ins.node);
+                    foo.function_val = arithmetic::new_function(node, ast_nodes::capture_scope(node));
+                    stack.emplace_back().set_value(foo);
+                    break;
+                }
+                case opCopyAggregate: {
+                    ast_nodes::LiteralNode* literal = static_cast<ast_nodes::LiteralNode*>(ins.node);
+                    stack.emplace_back().set_value(arithmetic::copy(*literal->aggregate));
+                    break;
+                }
+
+                case opDeclare: {
+                    ast_nodes::DeclarationNode* decl = static_cast<ast_nodes::DeclarationNode*>(ins.node);
+                    if (decl->self_captured) {
+                        ast_nodes::assign(scope->variables[decl->slot], stack.back());
+                    } else {
+                        scope->variables[decl->slot] = stack.back().cell();
+                    }
+                    stack.pop_back();
+                    break;
+                }
+                case opDeclareEmpty:
+                    scope->variables[static_cast<ast_nodes::DeclarationNode*>(ins.node)->slot] = arithmetic::new_cell();
+                    break;
+                case opAppend: {
+                    Operand& added = stack.back();
+                    Value* target = &stack[stack.size() - 2].get();
+                    if (target->type == 'a' && added.get().type == 'a') {
+                        arithmetic::op_plus_equality(target, added.get());
+                    } else {
+                        try {
+                            arithmetic::expose(*target);
+                            arithmetic::expose(added.get());
+                            added.set_value(arithmetic::apply_operator(*target, added.get(), '+'));
+                        } catch (std::invalid_argument& ex) {
+                            throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                        } catch (std::runtime_error& ex) {
+                            throw std::invalid_argument(evaluation_error_at(ins, ex.what()));
+                        }
+                        ast_nodes::assign(target, added);
+                    }
+                    stack.resize(stack.size() - 2);
+                    break;
+                }
+                case opAssign: {
+                    Operand& value = stack.back();
+                    Value* target = &stack[stack.size() - 2].get();
+                    switch (static_cast<ast_nodes::AssignmentNode*>(ins.node)->type) {
+                        case '=':
+                            ast_nodes::assign(target, value);
+                            break;
+                        case '+':
+                            arithmetic::op_plus_equality(target, value.get());
+                            break;
+                        case '-':
+                            arithmetic::op_minus_equality(target, value.get());
+                            break;
+                        default:
+                            throw std::invalid_argument(error_at(ins, "Expected :=, += or -= in supposed assignment"));
+                    }
+                    stack.resize(stack.size() - 2);
+                    break;
+                }
+                case opElementTarget: {
+                    Value& var = stack[stack.size() - 2].get();
+                    const Value& sub = stack.back().get();
+                    if (var.type != 'a') {
+                        throw std::invalid_argument(error_at(ins, "Expected array"));
+                    }
+                    if (sub.type != 'i') {
+                        throw std::invalid_argument(error_at(ins, "Expected integer as array index"));
+                    }
+                    arithmetic::make_private(var);
+                    arithmetic::store_target(var.array_val, sub.int_val);
+                    break;
+                }
+                case opStoreElement: {
+                    Operand& value = stack.back();
+                    const Value& sub = stack[stack.size() - 2].get();
+                    Value& target = stack[stack.size() - 3].get();
+                    // -> a value read from the array itself shares it by now
+                    arithmetic::make_private(target);
+                    char type = static_cast<ast_nodes::AssignmentNode*>(ins.node)->type;
+                    ast_nodes::store_element(target.array_val, sub.int_val, type, value);
+                    stack.resize(stack.size() - 3);
+                    break;
+                }
+                case opPrint:
+                    out << stack.back().get();
+                    stack.pop_back();
+                    break;
+
+                case opJump:
+                    ip = ins.arg;
+                    break;
+                case opAndSkip:
+                case opOrSkip: {
+                    Operand& left = stack.back();
+                    if (arithmetic::decides(left.get(), ins.op == opAndSkip ? -1 - 'a' : -1 - 'o')) {
+                        left.set_value(left.get());
+                        ip = ins.arg;
+                    }
+                    break;
+                }
+                case opIfFalse: {
+                    Value val = stack.back().get();
+                    stack.pop_back();
+                    if (val.type != 'b') {
+                        throw std::invalid_argument(error_at(ins, "If statement does not contain boolean as argument"));
+                    }
+                    if (!val.bool_val) ip = ins.arg;
+                    break;
+                }
+                case opWhileFalse: {
+                    Value val = stack.back().get();
+                    stack.pop_back();
+                    if (val.type != 'b') {
+                        throw std::invalid_argument(
+                                error_at(ins, "Expression in while loop does not evaluate to a boolean"));
+                    }
+                    if (!val.bool_val) ip = ins.arg;
+                    break;
+                }
+                case opOpenScope:
+                    if (arithmetic::collection_due()) {
+                        ast_nodes::begin_collection();
+                        for (auto& i: stack) ast_nodes::mark(i);
+                        for (auto& i: loops) ast_nodes::mark(i.rng_r);
+                        for (auto& i: frames) ast_nodes::mark(i.caller);
+                        ast_nodes::finish_collection();
+                    }
+                    ast_nodes::open_scope(ins.node, ins.arg);
+                    break;
+                case opCloseScope:
+                    for (int i = 0; i < ins.arg; ++i) {
+                        ast_nodes::close_scope();
+                    }
+                    break;
+                case opForInit: {
+                    Operand rng_r = stack.back();
+                    stack.pop_back();
+                    Value rng_l = stack.back().get();
+                    stack.pop_back();
+
+                    if (rng_l.type != 'i') {
+                        throw std::invalid_argument(error_at(ins, "Left bound of for loop is not and integer"));
+                    }
+                    if (rng_r.get().type != 'i') {
+                        throw std::invalid_argument(error_at(ins, "Right bound of for loop is not and integer"));
+                    }
+
+                    Value* iterator = arithmetic::new_cell();
+                    iterator->type = 'i';
+                    scope->variables[static_cast<ast_nodes::ForNode*>(ins.node)->slot] = iterator;
+                    loops.push_back({rng_l.int_val, rng_r, iterator});
+                    break;
+                }
+                case opForTest:
+                    if (loops.back().i > loops.back().rng_r.get().int_val) {
+                        ip = ins.arg;
+                    } else {
+                        loops.back().iterator->int_val = loops.back().i;
+                    }
+                    break;
+                case opForStep:
+                    ++loops.back().i;
+                    break;
+                case opForExit:
+                    loops.pop_back();
+                    break;
+                case opReturn:
+                    ast_nodes::return_register = &stack.back().get();
+                    // fall through
+                case opReturnNone: {
+                    bool temporary = ins.op == opReturn && stack.back().ref == nullptr;
+                    Value result = ast_nodes::returned_value(*ast_nodes::return_register, temporary);
+                    ast_nodes::return_register = &ast_nodes::constempty;
+                    leave_frame(result);
+                    break;
+                }
+                case opHalt:
+                    return;
+            }
+        }
+    }
+
+    void execute(ast_nodes::Node* tree, std::istream& in=std::cin, std::ostream& out=std::cout) {
+        ast_nodes::resolver::resolve(tree);
+        ast_nodes::scope = ast_nodes::builtin_scope();
+        run(compile(tree), in, out);
+    }
+}
+
+#endif // __BYTECODE_EXECUTE_INCLUDED__
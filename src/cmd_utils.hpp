@@ -25,36 +25,48 @@ namespace cmd_utils {
         std::ofstream* out_stream;
         bool human;
         bool verbose;
+        bool bytecode;
+        bool gc_stats;
+        long long gc_threshold;
     };
 
     void parse_args(int &argc, char* argv[], input_params &par, std::ostream* log = &std::cerr) {
 
         if (argc < 2) {
-            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v]\n";
+            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
             (*log) << "  infile      path to input file\n";
             (*log) << "  -o outfile  path to output file\n";
             (*log) << "  -h          output in a human readable way\n";
             (*log) << "  -v          verbose output\n";
+            (*log) << "  -b          execute using bytecode vm\n";
+            (*log) << "  -g          print garbage collector and allocator statistics\n";
+            (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
             throw std::invalid_argument("No input file specified");
         }
 
         if (!std::filesystem::is_regular_file(argv[1]) && !std::filesystem::is_symlink(argv[1])) {
-            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v]\n";
+            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
             (*log) << "  infile      path to input file\n";
             (*log) << "  -o outfile  path to output file\n";
             (*log) << "  -h          output in a human readable way\n";
             (*log) << "  -v          verbose output\n";
+            (*log) << "  -b          execute using bytecode vm\n";
+            (*log) << "  -g          print garbage collector and allocator statistics\n";
+            (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
             throw std::invalid_argument("Input file does not refer to a file");
         }
 
         std::ifstream* in = new std::ifstream(argv[1]);
 
         if (in->fail()) {
-            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v]\n";
+            (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
             (*log) << "  infile      path to input file\n";
             (*log) << "  -o outfile  path to output file\n";
             (*log) << "  -h          output in a human readable way\n";
             (*log) << "  -v          verbose output\n";
+            (*log) << "  -b          execute using bytecode vm\n";
+            (*log) << "  -g          print garbage collector and allocator statistics\n";
+            (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
             throw std::invalid_argument("Could not open input file");
         }
 
@@ -62,28 +74,37 @@ namespace cmd_utils {
         par.out_stream = nullptr;
         par.out_is_file = false;
         par.human = false;
+        par.bytecode = false;
+        par.gc_stats = false;
+        par.gc_threshold = 4096;
 
         int y = 2;
 
         while (y != argc) {
             if (strcmp(argv[y], "-o") == 0) {
                 if (y + 1 == argc) {
-                    (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v]\n";
+                    (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
                     (*log) << "  infile      path to input file\n";
                     (*log) << "  -o outfile  path to output file\n";
                     (*log) << "  -h          output in a human readable way\n";
                     (*log) << "  -v          verbose output\n";
+                    (*log) << "  -b          execute using bytecode vm\n";
+                    (*log) << "  -g          print garbage collector and allocator statistics\n";
+                    (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
                     throw std::invalid_argument("No output file after flag");
                 }
 
                 std::ofstream* out = new std::ofstream(argv[y + 1]);
 
                 if (out->fail()) {
-                    (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v]\n";
+                    (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
                     (*log) << "  infile      path to input file\n";
                     (*log) << "  -o outfile  path to output file\n";
                     (*log) << "  -h          output in a human readable way\n";
                     (*log) << "  -v          verbose output\n";
+                    (*log) << "  -b          execute using bytecode vm\n";
+                    (*log) << "  -g          print garbage collector and allocator statistics\n";
+                    (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
                     throw std::invalid_argument("Could not open output file");
                 }
 
@@ -95,6 +116,25 @@ namespace cmd_utils {
                 par.human = true;
             } else if (strcmp(argv[y], "-v") == 0) {
                 par.verbose = true;
+            } else if (strcmp(argv[y], "-b") == 0) {
+                par.bytecode = true;
+            } else if (strcmp(argv[y], "-g") == 0) {
+                par.gc_stats = true;
+            } else if (strcmp(argv[y], "-t") == 0) {
+                if (y + 1 == argc) {
+                    (*log) << "Usage: " << argv[0] << " infile [-o outfile] [-h] [-v] [-b] [-g] [-t kbytes]\n";
+                    (*log) << "  infile      path to input file\n";
+                    (*log) << "  -o outfile  path to output file\n";
+                    (*log) << "  -h          output in a human readable way\n";
+                    (*log) << "  -v          verbose output\n";
+                    (*log) << "  -b          execute using bytecode vm\n";
+                    (*log) << "  -g          print garbage collector and allocator statistics\n";
+                    (*log) << "  -t kbytes   heap size that triggers garbage collection\n";
+                    throw std::invalid_argument("No heap size after flag");
+                }
+
+                par.gc_threshold = std::stoll(argv[y + 1]);
+                ++y;
             }
             ++y;
         }
@@ -4,6 +4,7 @@
 #include "cmd_utils.hpp"
 #include "token_data.hpp"
 #include "ast_lib.hpp"
+#include "bytecode_execute.hpp"
 #include "analyzers/analyze.hpp"
 #include "optimizers/optimize.hpp"
 
@@ -23,8 +24,19 @@ int main(int argc, char* argv[]) {
     analyzers::verbose = param.verbose;
     optimizers::verbose = param.verbose;
 
-    analyzers::analyze(tree, &std::cout);
+    analyzers::analyze(tree, &std::cerr);
     for (int iter = 0; iter < 3; ++iter) optimizers::optimize(tree, &std::cout);
 
-    ast_nodes::execute(tree);
+    arithmetic::set_gc_threshold(param.gc_threshold << 10);
+
+    if (param.bytecode) {
+        bytecode::execute(tree);
+    } else {
+        ast_nodes::execute(tree);
+    }
+
+    if (param.gc_stats) {
+        arithmetic::print_gc_stats(std::cerr);
+        pool::print_stats(std::cerr);
+    }
 }
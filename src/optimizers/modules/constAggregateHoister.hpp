@@ -0,0 +1,91 @@
+#ifndef __OPTIMIZERS_CONSTANT_AGGREGATE_HOISTER_INCLUDED__
+#define __OPTIMIZERS_CONSTANT_AGGREGATE_HOISTER_INCLUDED__
+
+#include <iostream>
+#include <vector>
+
+#include "../../ast_lib.hpp"
+#include "../../arithmetic.hpp"
+
+namespace optimizers {
+    namespace const_aggregate_hoister {
+
+        const std::string name = "const_aggregate_hoister";
+
+        // Value of an element made of a single literal, nullptr if it has to be evaluated
+        arithmetic::Value* element_value(ast_nodes::Node* node) {
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(node);
+            if (expr_node == nullptr || !expr_node->ops.empty()) return nullptr;
+
+            ast_nodes::UnaryNode* unary_node = dynamic_cast<ast_nodes::UnaryNode*>(expr_node->terms[0]);
+            if (unary_node == nullptr || unary_node->unaryop != '#' || unary_node->type_ind != '#') return nullptr;
+
+            ast_nodes::PrimaryNode* primary_node = dynamic_cast<ast_nodes::PrimaryNode*>(unary_node->primary);
+            if (primary_node == nullptr || primary_node->type != 'l') return nullptr;
+
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(primary_node->literal);
+            if (literal_node == nullptr) return nullptr;
+
+            if (literal_node->type == 'a' || literal_node->type == 't') return literal_node->aggregate;
+
+            ast_nodes::resolver::make_constant(literal_node);
+            return literal_node->constant;
+        }
+
+        // -> templates are built from untracked objects, the collector only ever sees their copies
+        void at_exit(ast_nodes::Node* node) {
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(node);
+
+            if (literal_node == nullptr || literal_node->aggregate != nullptr) return;
+
+            std::vector <ast_nodes::Node*>* values;
+            if (literal_node->type == 'a') {
+                values = &dynamic_cast<ast_nodes::ArrayLiteralNode*>(literal_node->array_val)->values;
+            } else if (literal_node->type == 't') {
+                values = &dynamic_cast<ast_nodes::TupleLiteralNode*>(literal_node->tuple_val)->values;
+            } else {
+                return;
+            }
+
+            std::vector <arithmetic::Value*> elements;
+            for (auto i: *values) {
+                arithmetic::Value* element = element_value(i);
+                if (element == nullptr) return;
+                elements.push_back(element);
+            }
+
+            arithmetic::Value aggregate;
+            aggregate.type = literal_node->type;
+
+            if (literal_node->type == 'a') {
+                aggregate.array_val = new arithmetic::Array();
+                aggregate.array_val->aliased = false;
+                for (int i = 0; i < elements.size(); ++i) {
+                    aggregate.array_val->insert(i + 1, arithmetic::new_constant(*elements[i]));
+                }
+            } else {
+                ast_nodes::TupleLiteralNode* tuple_node = dynamic_cast<ast_nodes::TupleLiteralNode*>(literal_node->tuple_val);
+                arithmetic::Tuple* tuple = new arithmetic::Tuple();
+                tuple->aliased = false;
+                for (int i = 0; i < elements.size(); ++i) {
+                    tuple->shape = arithmetic::extend(tuple->shape, tuple_node->identifiers[i]);
+                    // -> repeated keys are reported when the literal is evaluated
+                    if (tuple->shape == nullptr) {
+                        delete tuple;
+                        return;
+                    }
+                    tuple->array_values.push_back(arithmetic::new_constant(*elements[i]));
+                }
+                aggregate.tuple_val = tuple;
+            }
+
+            literal_node->aggregate = arithmetic::new_constant(aggregate);
+        }
+
+        void optimize(ast_nodes::Node* tree, std::ostream* log = &std::cerr) {
+            tree->visit(ast_nodes::dummy, ast_nodes::dummy, at_exit);
+        }
+    }
+}
+
+#endif // __OPTIMIZERS_CONSTANT_AGGREGATE_HOISTER_INCLUDED__
@@ -16,7 +16,9 @@ namespace optimizers {
             ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(node);
 
             if (expr_node != nullptr) {
-                std::vector <arithmetic::AmbiguousVariable*> calced_terms;
+                std::vector <arithmetic::Value> values;
+                std::vector <const arithmetic::Value*> calced_terms;
+                values.reserve(expr_node->terms.size());
                 calced_terms.reserve(expr_node->terms.size());
 
                 for (auto i: expr_node->terms) {
@@ -42,21 +44,21 @@ namespace optimizers {
                         return;
                     }
 
-                    arithmetic::AmbiguousVariable* value = new arithmetic::AmbiguousVariable();
-                    value->type = literal_node->type;
+                    arithmetic::Value value;
+                    value.type = literal_node->type;
 
                     switch (literal_node->type) {
                         case 'i':
-                            value->int_val = literal_node->int_val;
+                            value.int_val = literal_node->int_val;
                             break;
                         case 'r':
-                            value->real_val = literal_node->real_val;
+                            value.real_val = literal_node->real_val;
                             break;
                         case 'b':
-                            value->bool_val = literal_node->bool_val;
+                            value.bool_val = literal_node->bool_val;
                             break;
                         case 's':
-                            value->string_val = literal_node->string_val;
+                            value.string_val = arithmetic::new_string(literal_node->string_val);
                             break;
                         case 'e':
                             break;
@@ -74,15 +76,16 @@ namespace optimizers {
                     }
 
                     if (unary_node->type_ind != '#') {
-                        arithmetic::AmbiguousVariable* is_type = new arithmetic::AmbiguousVariable();
-                        is_type->type = 'b';
-                        is_type->bool_val = (unary_node->type_ind == value->type);
+                        arithmetic::Value is_type;
+                        is_type.type = 'b';
+                        is_type.bool_val = (unary_node->type_ind == value.type);
                         value = is_type;
                     }
-                    calced_terms.push_back(value);
+                    values.push_back(value);
+                    calced_terms.push_back(&values.back());
                 }
 
-                arithmetic::AmbiguousVariable* simplified;
+                arithmetic::Value simplified;
                 try {
                     simplified = evaluate_expression(calced_terms, expr_node->ops);
                 } catch (std::invalid_argument& ex) {
@@ -105,19 +108,19 @@ namespace optimizers {
 
                 ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(primary_node->literal);
 
-                literal_node->type = simplified->type;
-                switch (simplified->type) {
+                literal_node->type = simplified.type;
+                switch (simplified.type) {
                     case 'i':
-                        literal_node->int_val = simplified->int_val;
+                        literal_node->int_val = simplified.int_val;
                         break;
                     case 'r':
-                        literal_node->real_val = simplified->real_val;
+                        literal_node->real_val = simplified.real_val;
                         break;
                     case 'b':
-                        literal_node->bool_val = simplified->bool_val;
+                        literal_node->bool_val = simplified.bool_val;
                         break;
                     case 's':
-                        literal_node->string_val = simplified->string_val;
+                        literal_node->string_val = arithmetic::text(simplified.string_val);
                         break;
                     case 'e':
                         break;
@@ -0,0 +1,133 @@
+#ifndef __OPTIMIZERS_SLICE_RECOGNIZER_INCLUDED__
+#define __OPTIMIZERS_SLICE_RECOGNIZER_INCLUDED__
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../ast_lib.hpp"
+
+namespace optimizers {
+    namespace slice_recognizer {
+
+        const std::string name = "slice_recognizer";
+
+        // Primary of a term without unary operator or type check, nullptr otherwise
+        ast_nodes::PrimaryNode* term_primary(ast_nodes::Node* node) {
+            ast_nodes::UnaryNode* unary_node = dynamic_cast<ast_nodes::UnaryNode*>(node);
+            if (unary_node == nullptr || unary_node->unaryop != '#' || unary_node->type_ind != '#') return nullptr;
+            return dynamic_cast<ast_nodes::PrimaryNode*>(unary_node->primary);
+        }
+
+        // Primary of an expression made of a single term without operators, nullptr otherwise
+        ast_nodes::PrimaryNode* single_primary(ast_nodes::Node* node) {
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(node);
+            if (expr_node == nullptr || !expr_node->ops.empty()) return nullptr;
+            return term_primary(expr_node->terms[0]);
+        }
+
+        bool is_variable(ast_nodes::PrimaryNode* primary, const std::string& identifier) {
+            return primary != nullptr && primary->type == 'v' && primary->tails.empty() &&
+                   primary->identifier == identifier;
+        }
+
+        // Literal of an array with no elements
+        bool is_empty_array(ast_nodes::PrimaryNode* primary) {
+            if (primary == nullptr || primary->type != 'l') return false;
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(primary->literal);
+            return literal_node->type == 'a' &&
+                   dynamic_cast<ast_nodes::ArrayLiteralNode*>(literal_node->array_val)->values.empty();
+        }
+
+        int param_index(ast_nodes::FunctionNode* function_node, const std::string& identifier) {
+            auto found = std::find(function_node->params.begin(), function_node->params.end(), identifier);
+            return found == function_node->params.end() ? -1 : found - function_node->params.begin();
+        }
+
+        // -> the idiom is
+        //   var result := []
+        //   for i in l .. r loop result := result + [arr[i]] end
+        //   return result
+        // with arr, l and r parameters and result and i local names
+        void at_enter(ast_nodes::Node* node) {
+            ast_nodes::FunctionNode* function_node = dynamic_cast<ast_nodes::FunctionNode*>(node);
+
+            if (function_node == nullptr || function_node->type != 'b' ||
+                function_node->native != ast_nodes::Native::None) {
+                return;
+            }
+
+            ast_nodes::BodyNode* body_node = dynamic_cast<ast_nodes::BodyNode*>(function_node->body);
+            if (body_node->statements.size() != 3) return;
+
+            ast_nodes::DeclarationNode* decl_node = dynamic_cast<ast_nodes::DeclarationNode*>(body_node->statements[0]);
+            ast_nodes::ForNode* for_node = dynamic_cast<ast_nodes::ForNode*>(body_node->statements[1]);
+            ast_nodes::ControlNode* return_node = dynamic_cast<ast_nodes::ControlNode*>(body_node->statements[2]);
+            if (decl_node == nullptr || for_node == nullptr || return_node == nullptr) return;
+
+            const std::string& result = decl_node->identifier;
+            const std::string& index = for_node->identifier;
+            if (result == index || param_index(function_node, result) >= 0 ||
+                param_index(function_node, index) >= 0) {
+                return;
+            }
+
+            if (decl_node->value == nullptr || !is_empty_array(single_primary(decl_node->value))) return;
+            if (return_node->type != 'r' || return_node->value == nullptr ||
+                !is_variable(single_primary(return_node->value), result)) {
+                return;
+            }
+
+            ast_nodes::PrimaryNode* from = single_primary(for_node->range_expr_l);
+            ast_nodes::PrimaryNode* to = single_primary(for_node->range_expr_r);
+            if (from == nullptr || to == nullptr || from->type != 'v' || to->type != 'v' ||
+                !from->tails.empty() || !to->tails.empty()) {
+                return;
+            }
+
+            ast_nodes::BodyNode* loop_body = dynamic_cast<ast_nodes::BodyNode*>(for_node->body);
+            if (loop_body == nullptr || loop_body->statements.size() != 1) return;
+
+            ast_nodes::AssignmentNode* assignment_node = dynamic_cast<ast_nodes::AssignmentNode*>(
+                    loop_body->statements[0]);
+            if (assignment_node == nullptr || assignment_node->type != '=' ||
+                !is_variable(dynamic_cast<ast_nodes::PrimaryNode*>(assignment_node->primary), result)) {
+                return;
+            }
+
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(assignment_node->expression);
+            if (expr_node == nullptr || expr_node->ops.size() != 1 || expr_node->ops[0] != '+' ||
+                !is_variable(term_primary(expr_node->terms[0]), result)) {
+                return;
+            }
+
+            ast_nodes::PrimaryNode* appended = term_primary(expr_node->terms[1]);
+            if (appended == nullptr || appended->type != 'l') return;
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(appended->literal);
+            if (literal_node->type != 'a') return;
+            std::vector <ast_nodes::Node*>& values = dynamic_cast<ast_nodes::ArrayLiteralNode*>(
+                    literal_node->array_val)->values;
+            if (values.size() != 1) return;
+
+            ast_nodes::PrimaryNode* element = single_primary(values[0]);
+            if (element == nullptr || element->type != 'v' || element->tails.size() != 1) return;
+            ast_nodes::TailNode* tail = dynamic_cast<ast_nodes::TailNode*>(element->tails[0]);
+            if (tail->type != 's' || !is_variable(single_primary(tail->subscript), index)) return;
+
+            std::vector<int> params = {param_index(function_node, element->identifier),
+                                       param_index(function_node, from->identifier),
+                                       param_index(function_node, to->identifier)};
+            if (std::find(params.begin(), params.end(), -1) != params.end()) return;
+
+            function_node->native = ast_nodes::Native::Slice;
+            function_node->native_params = params;
+        }
+
+        void optimize(ast_nodes::Node* tree, std::ostream* log = &std::cerr) {
+            tree->visit(at_enter, ast_nodes::dummy, ast_nodes::dummy);
+        }
+    }
+}
+
+#endif // __OPTIMIZERS_SLICE_RECOGNIZER_INCLUDED__
@@ -0,0 +1,328 @@
+#ifndef __OPTIMIZERS_TUPLE_FIELD_RESOLVER_INCLUDED__
+#define __OPTIMIZERS_TUPLE_FIELD_RESOLVER_INCLUDED__
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../ast_lib.hpp"
+
+namespace optimizers {
+    namespace tuple_field_resolver {
+
+        const std::string name = "tuple_field_resolver";
+
+        // Names of the positions of a tuple, empty for unnamed ones
+        typedef std::vector <std::string> Layout;
+
+        struct binding {
+            std::string identifier;
+            int level;
+            bool pending;
+            // nullptr for parameters and loop iterators
+            ast_nodes::DeclarationNode* declaration;
+        };
+
+        std::vector <std::vector<binding>> scopes;
+        std::vector <ast_nodes::FunctionNode*> functions;
+
+        // Declaration every variable reference resolves to, scoped the same way the resolver does it
+        std::unordered_map<ast_nodes::PrimaryNode*, ast_nodes::DeclarationNode*> declarations;
+        // `var u := t` makes u share the cell of t
+        std::unordered_map<ast_nodes::DeclarationNode*, ast_nodes::DeclarationNode*> aliases;
+        // Declarations whose cell may get a value other than the one of their initializer, set on the
+        // first declaration of each group sharing a cell
+        std::unordered_map<ast_nodes::DeclarationNode*, bool> rebound;
+        std::unordered_map<ast_nodes::FunctionNode*, std::vector<ast_nodes::ControlNode*>> returns;
+
+        // -> nullopt while being computed, so recursion gives up instead of looping
+        std::unordered_map<ast_nodes::DeclarationNode*, std::optional<Layout>> declaration_layouts;
+        std::unordered_map<ast_nodes::FunctionNode*, std::optional<Layout>> return_layouts;
+
+        std::optional<Layout> layout_of(ast_nodes::Node* node);
+
+        // Function literal a declaration is initialized with, nullptr otherwise
+        ast_nodes::FunctionNode* function_of(ast_nodes::DeclarationNode* declaration) {
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(declaration->value);
+            if (expr_node == nullptr || !expr_node->ops.empty()) return nullptr;
+
+            ast_nodes::UnaryNode* unary_node = dynamic_cast<ast_nodes::UnaryNode*>(expr_node->terms[0]);
+            if (unary_node == nullptr || unary_node->unaryop != '#' || unary_node->type_ind != '#') return nullptr;
+
+            ast_nodes::PrimaryNode* primary_node = dynamic_cast<ast_nodes::PrimaryNode*>(unary_node->primary);
+            if (primary_node == nullptr || primary_node->type != 'l') return nullptr;
+
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(primary_node->literal);
+            if (literal_node->type != 'f') return nullptr;
+            return dynamic_cast<ast_nodes::FunctionNode*>(literal_node->func_val);
+        }
+
+        ast_nodes::DeclarationNode* group_of(ast_nodes::DeclarationNode* declaration) {
+            while (aliases.count(declaration)) declaration = aliases[declaration];
+            return declaration;
+        }
+
+        bool is_stable(ast_nodes::DeclarationNode* declaration) {
+            return declaration != nullptr && !rebound[group_of(declaration)];
+        }
+
+        // Layout of every tuple a declared variable can hold
+        std::optional<Layout> declaration_layout(ast_nodes::DeclarationNode* declaration) {
+            if (!is_stable(declaration) || declaration->value == nullptr) return std::nullopt;
+
+            auto found = declaration_layouts.find(declaration);
+            if (found != declaration_layouts.end()) return found->second;
+
+            declaration_layouts[declaration] = std::nullopt;
+            std::optional<Layout> layout = aliases.count(declaration) ? declaration_layout(aliases[declaration])
+                                                                      : layout_of(declaration->value);
+            declaration_layouts[declaration] = layout;
+            return layout;
+        }
+
+        // Layout of every tuple a call of the function can return
+        std::optional<Layout> return_layout(ast_nodes::FunctionNode* function_node) {
+            auto found = return_layouts.find(function_node);
+            if (found != return_layouts.end()) return found->second;
+
+            return_layouts[function_node] = std::nullopt;
+            std::optional<Layout> layout;
+            if (function_node->type == 'l') {
+                layout = layout_of(function_node->body);
+            } else {
+                // -> returns without a value and running off the end give empty, which is not a tuple at all
+                for (auto i: returns[function_node]) {
+                    if (i->value == nullptr) continue;
+                    std::optional<Layout> returned = layout_of(i->value);
+                    if (!returned || (layout && *layout != *returned)) {
+                        layout = std::nullopt;
+                        break;
+                    }
+                    layout = returned;
+                }
+            }
+            return_layouts[function_node] = layout;
+            return layout;
+        }
+
+        std::optional<Layout> concatenate(const Layout& left, const Layout& right) {
+            Layout result = left;
+            for (auto& i: right) {
+                if (!i.empty() && std::find(left.begin(), left.end(), i) != left.end()) return std::nullopt;
+                result.push_back(i);
+            }
+            return result;
+        }
+
+        // Layout of the value of a variable reference with its first tails_used tails applied
+        std::optional<Layout> reference_layout(ast_nodes::PrimaryNode* primary, int tails_used) {
+            ast_nodes::DeclarationNode* declaration = declarations[primary];
+            if (tails_used == 0) return declaration_layout(declaration);
+
+            ast_nodes::TailNode* tail = dynamic_cast<ast_nodes::TailNode*>(primary->tails[0]);
+            if (tails_used > 1 || tail->type != 'p' || !is_stable(declaration) ||
+                declaration->value == nullptr) {
+                return std::nullopt;
+            }
+
+            ast_nodes::FunctionNode* function_node = function_of(declaration);
+            if (function_node == nullptr) return std::nullopt;
+            return return_layout(function_node);
+        }
+
+        // Layout of every tuple the expression can evaluate to, nullopt if it is not known
+        std::optional<Layout> layout_of(ast_nodes::Node* node) {
+            if (ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(node)) {
+                std::optional<Layout> layout = layout_of(expr_node->terms[0]);
+                for (int i = 0; i < expr_node->ops.size() && layout; ++i) {
+                    std::optional<Layout> term = layout_of(expr_node->terms[i + 1]);
+                    if (expr_node->ops[i] != '+' || !term) return std::nullopt;
+                    layout = concatenate(*layout, *term);
+                }
+                return layout;
+            }
+
+            if (ast_nodes::UnaryNode* unary_node = dynamic_cast<ast_nodes::UnaryNode*>(node)) {
+                if (unary_node->unaryop != '#' || unary_node->type_ind != '#') return std::nullopt;
+                return layout_of(unary_node->primary);
+            }
+
+            ast_nodes::PrimaryNode* primary_node = dynamic_cast<ast_nodes::PrimaryNode*>(node);
+            if (primary_node == nullptr) return std::nullopt;
+
+            if (primary_node->type == 'v') return reference_layout(primary_node, primary_node->tails.size());
+            if (primary_node->type == 'e') return layout_of(primary_node->expression);
+            if (primary_node->type != 'l') return std::nullopt;
+
+            ast_nodes::LiteralNode* literal_node = dynamic_cast<ast_nodes::LiteralNode*>(primary_node->literal);
+            if (literal_node->type != 't') return std::nullopt;
+
+            Layout layout;
+            for (auto& i: dynamic_cast<ast_nodes::TupleLiteralNode*>(literal_node->tuple_val)->identifiers) {
+                if (!i.empty() && std::find(layout.begin(), layout.end(), i) != layout.end()) return std::nullopt;
+                layout.push_back(i);
+            }
+            return layout;
+        }
+
+        void lookup(ast_nodes::PrimaryNode* primary) {
+            for (int depth = (int) scopes.size() - 1; depth >= 0; --depth) {
+                std::vector <binding>& bindings = scopes[depth];
+                for (int i = (int) bindings.size() - 1; i >= 0; --i) {
+                    if (bindings[i].identifier != primary->identifier) continue;
+                    if (bindings[i].pending && bindings[i].level == (int) functions.size()) continue;
+                    declarations[primary] = bindings[i].declaration;
+                    return;
+                }
+            }
+            declarations[primary] = nullptr;
+        }
+
+        // A variable used without tails keeps its cell to itself only where its value is read or copied,
+        // declarations initialized with it share the cell and anything else may assign to it
+        void note_use(ast_nodes::PrimaryNode* primary) {
+            ast_nodes::DeclarationNode* declaration = declarations[primary];
+            if (declaration == nullptr || !primary->tails.empty()) return;
+
+            ast_nodes::AssignmentNode* assignment = dynamic_cast<ast_nodes::AssignmentNode*>(primary->parent);
+            if (assignment != nullptr && assignment->primary == primary) {
+                rebound[declaration] = true;
+                return;
+            }
+
+            ast_nodes::UnaryNode* unary_node = dynamic_cast<ast_nodes::UnaryNode*>(primary->parent);
+            if (unary_node == nullptr) {
+                rebound[declaration] = true;
+                return;
+            }
+            if (unary_node->unaryop != '#' || unary_node->type_ind != '#') return;
+
+            ast_nodes::ExpressionNode* expr_node = dynamic_cast<ast_nodes::ExpressionNode*>(unary_node->parent);
+            if (expr_node == nullptr) {
+                rebound[declaration] = true;
+                return;
+            }
+            if (!expr_node->ops.empty()) return;
+
+            ast_nodes::Node* user = expr_node->parent;
+            ast_nodes::DeclarationNode* decl_node = dynamic_cast<ast_nodes::DeclarationNode*>(user);
+            if (decl_node != nullptr) {
+                aliases[decl_node] = declaration;
+                return;
+            }
+
+            // -> tuple literals copy their elements and calls copy the returned value
+            if (dynamic_cast<ast_nodes::AssignmentNode*>(user) != nullptr ||
+                dynamic_cast<ast_nodes::ControlNode*>(user) != nullptr ||
+                dynamic_cast<ast_nodes::PrintNode*>(user) != nullptr ||
+                dynamic_cast<ast_nodes::IfNode*>(user) != nullptr ||
+                dynamic_cast<ast_nodes::WhileNode*>(user) != nullptr ||
+                dynamic_cast<ast_nodes::TupleLiteralNode*>(user) != nullptr) {
+                return;
+            }
+            rebound[declaration] = true;
+        }
+
+        void at_enter(ast_nodes::Node* node) {
+            ast_nodes::BodyNode*        body_node =    dynamic_cast<ast_nodes::BodyNode*>       (node);
+            ast_nodes::ForNode*         for_node =     dynamic_cast<ast_nodes::ForNode*>        (node);
+            ast_nodes::FunctionNode*    func_node =    dynamic_cast<ast_nodes::FunctionNode*>   (node);
+            ast_nodes::DeclarationNode* decl_node =    dynamic_cast<ast_nodes::DeclarationNode*>(node);
+            ast_nodes::PrimaryNode*     primary_node = dynamic_cast<ast_nodes::PrimaryNode*>    (node);
+            ast_nodes::ControlNode*     ctrl_node =    dynamic_cast<ast_nodes::ControlNode*>    (node);
+
+            if (body_node != nullptr) {
+                ast_nodes::ForNode* loop = dynamic_cast<ast_nodes::ForNode*>(node->parent);
+                if (loop != nullptr && loop->body == node) {
+                    scopes.back().back().pending = false;
+                }
+                scopes.emplace_back();
+            } else if (for_node != nullptr) {
+                scopes.emplace_back();
+                scopes.back().push_back({for_node->identifier, (int) functions.size(), true, nullptr});
+            } else if (func_node != nullptr) {
+                functions.push_back(func_node);
+                scopes.emplace_back();
+                for (auto& i: func_node->params) {
+                    scopes.back().push_back({i, (int) functions.size(), false, nullptr});
+                }
+            } else if (decl_node != nullptr) {
+                scopes.back().push_back({decl_node->identifier, (int) functions.size(), true, decl_node});
+            } else if (primary_node != nullptr && primary_node->type == 'v') {
+                lookup(primary_node);
+                note_use(primary_node);
+            } else if (ctrl_node != nullptr && ctrl_node->type == 'r' && !functions.empty()) {
+                returns[functions.back()].push_back(ctrl_node);
+            }
+        }
+
+        void at_exit(ast_nodes::Node* node) {
+            ast_nodes::DeclarationNode* decl_node = dynamic_cast<ast_nodes::DeclarationNode*>(node);
+
+            if (dynamic_cast<ast_nodes::BodyNode*>(node) != nullptr ||
+                dynamic_cast<ast_nodes::ForNode*>(node) != nullptr) {
+                scopes.pop_back();
+            } else if (dynamic_cast<ast_nodes::FunctionNode*>(node) != nullptr) {
+                functions.pop_back();
+                scopes.pop_back();
+            } else if (decl_node != nullptr) {
+                for (auto i = scopes.back().rbegin(); i != scopes.back().rend(); ++i) {
+                    if (i->declaration == decl_node) {
+                        i->pending = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // `.name` tails of tuples whose layout is known become positional `.N` tails
+        void rewrite(ast_nodes::Node* node) {
+            ast_nodes::PrimaryNode* primary_node = dynamic_cast<ast_nodes::PrimaryNode*>(node);
+            if (primary_node == nullptr || primary_node->type != 'v') return;
+
+            for (int i = 0; i < primary_node->tails.size(); ++i) {
+                ast_nodes::TailNode* tail = dynamic_cast<ast_nodes::TailNode*>(primary_node->tails[i]);
+                if (tail->type != 'i') continue;
+
+                std::optional<Layout> layout = reference_layout(primary_node, i);
+                if (!layout) continue;
+
+                auto field = std::find(layout->begin(), layout->end(), tail->identifier);
+                if (field == layout->end()) continue;
+
+                tail->type = 't';
+                tail->tuple_idx = field - layout->begin() + 1;
+            }
+        }
+
+        void optimize(ast_nodes::Node* tree, std::ostream* log = &std::cerr) {
+            scopes.assign(1, {});
+            functions.clear();
+            declarations.clear();
+            aliases.clear();
+            rebound.clear();
+            returns.clear();
+            declaration_layouts.clear();
+            return_layouts.clear();
+
+            ast_nodes::assign_parents(tree);
+            tree->visit(at_enter, ast_nodes::dummy, at_exit);
+
+            // -> assigning to any variable sharing a cell rebinds all of them
+            std::vector <ast_nodes::DeclarationNode*> assigned;
+            for (auto& [declaration, is_rebound]: rebound) {
+                if (is_rebound) assigned.push_back(declaration);
+            }
+            for (auto i: assigned) {
+                rebound[group_of(i)] = true;
+            }
+
+            tree->visit(rewrite, ast_nodes::dummy, ast_nodes::dummy);
+        }
+    }
+}
+
+#endif // __OPTIMIZERS_TUPLE_FIELD_RESOLVER_INCLUDED__
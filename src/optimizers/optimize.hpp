@@ -9,6 +9,9 @@
 #include "./modules/ifSimplifier.hpp"
 #include "./modules/unreachableSimplifier.hpp"
 #include "./modules/constExprSimplifier.hpp"
+#include "./modules/constAggregateHoister.hpp"
+#include "./modules/sliceRecognizer.hpp"
+#include "./modules/tupleFieldResolver.hpp"
 
 namespace optimizers {
 
@@ -24,7 +27,10 @@ namespace optimizers {
         std::vector <optimizer_data> optimizers = {
                 {if_simplifier::name,          if_simplifier::optimize},
                 {unreachable_simplifier::name, unreachable_simplifier::optimize},
-                {const_simplifier::name, const_simplifier::optimize}
+                {const_simplifier::name, const_simplifier::optimize},
+                {const_aggregate_hoister::name, const_aggregate_hoister::optimize},
+                {slice_recognizer::name, slice_recognizer::optimize},
+                {tuple_field_resolver::name, tuple_field_resolver::optimize}
         };
 
         for (optimizer_data& i: optimizers) {
@@ -1,4 +1,5 @@
 #include "../ast_lib.hpp"
+#include "../bytecode_execute.hpp"
 #include "../cmd_utils.hpp"
 
 int main(int argc, char* argv[]) {
@@ -7,5 +8,16 @@ int main(int argc, char* argv[]) {
 
     ast_nodes::Node* tree = ast_nodes::readTree(*param.in_stream);
 
-    ast_nodes::execute(tree, std::cin, std::cout);
+    arithmetic::set_gc_threshold(param.gc_threshold << 10);
+
+    if (param.bytecode) {
+        bytecode::execute(tree, std::cin, std::cout);
+    } else {
+        ast_nodes::execute(tree, std::cin, std::cout);
+    }
+
+    if (param.gc_stats) {
+        arithmetic::print_gc_stats(std::cerr);
+        pool::print_stats(std::cerr);
+    }
 }
@@ -0,0 +1,154 @@
+#ifndef __POOL_INCLUDED__
+#define __POOL_INCLUDED__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+
+namespace pool {
+
+    // Requests are rounded up to a multiple of granularity, bigger ones than max_size go straight to malloc
+    const size_t granularity = 16;
+    const size_t max_size = 512;
+    const size_t class_count = max_size / granularity;
+    const size_t slab_size = 64 * 1024;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct SizeClass {
+        FreeNode* free_list = nullptr;
+        long long slabs = 0;
+        long long allocations = 0;
+        long long frees = 0;
+    };
+
+    SizeClass size_classes[class_count];
+
+    long long large_allocations = 0;
+    long long large_frees = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    size_t class_of(size_t size) {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    size_t class_size(size_t index) {
+        return (index + 1) * granularity;
+    }
+
+    // Cuts a new slab into objects of one size class, lower addresses are handed out first
+    void refill(SizeClass& size_class, size_t object_size) {
+        char* slab = static_cast<char*>(std::malloc(slab_size));
+        if (slab == nullptr) throw std::bad_alloc();
+
+        for (size_t offset = (slab_size / object_size) * object_size; offset != 0;) {
+            offset -= object_size;
+            FreeNode* node = reinterpret_cast<FreeNode*>(slab + offset);
+            node->next = size_class.free_list;
+            size_class.free_list = node;
+        }
+        ++size_class.slabs;
+    }
+
+    void* allocate(size_t size) {
+        if (size > max_size) {
+            void* memory = std::malloc(size);
+            if (memory == nullptr) throw std::bad_alloc();
+            ++large_allocations;
+            return memory;
+        }
+
+        size_t index = class_of(size);
+        SizeClass& size_class = size_classes[index];
+        if (size_class.free_list == nullptr) refill(size_class, class_size(index));
+
+        FreeNode* node = size_class.free_list;
+        size_class.free_list = node->next;
+        ++size_class.allocations;
+        return node;
+    }
+
+    void deallocate(void* memory, size_t size) {
+        if (memory == nullptr) return;
+
+        if (size > max_size) {
+            std::free(memory);
+            ++large_frees;
+            return;
+        }
+
+        SizeClass& size_class = size_classes[class_of(size)];
+        FreeNode* node = static_cast<FreeNode*>(memory);
+        node->next = size_class.free_list;
+        size_class.free_list = node;
+        ++size_class.frees;
+    }
+
+    // Lets standard containers take their nodes and buffers from the pool
+    template<typename T>
+    struct allocator {
+        using value_type = T;
+
+        allocator() = default;
+
+        template<typename U>
+        allocator(const allocator<U>&) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(pool::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* memory, size_t n) {
+            pool::deallocate(memory, n * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const allocator<U>&) const {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const allocator<U>&) const {
+            return false;
+        }
+    };
+
+    // Fragmentation is the share of slab memory that is not occupied by live objects
+    void print_stats(std::ostream& out) {
+        long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        if (elapsed_ms == 0) elapsed_ms = 1;
+
+        long long allocations = 0;
+        long long live_bytes = 0;
+        long long slab_bytes = 0;
+
+        for (size_t i = 0; i < class_count; ++i) {
+            const SizeClass& size_class = size_classes[i];
+            if (size_class.slabs == 0) continue;
+
+            long long live = size_class.allocations - size_class.frees;
+            long long capacity = size_class.slabs * (slab_size / class_size(i));
+            out << std::format("pool {}: {} allocations, {} live, {} slabs, {}% fragmentation",
+                               class_size(i), size_class.allocations, live, size_class.slabs,
+                               100 - live * 100 / capacity) << std::endl;
+
+            allocations += size_class.allocations;
+            live_bytes += live * class_size(i);
+            slab_bytes += size_class.slabs * slab_size;
+        }
+
+        out << std::format("pool: {} allocations, {} per ms, {} bytes in slabs, {}% fragmentation, {} large allocations",
+                           allocations, allocations / elapsed_ms, slab_bytes,
+                           slab_bytes == 0 ? 0 : 100 - live_bytes * 100 / slab_bytes, large_allocations)
+            << std::endl;
+    }
+}
+
+#endif // __POOL_INCLUDED__